@@ -5,15 +5,15 @@
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
+#include <time.h>
+#include <pthread.h>
+#include "city.h"
+#include "distmat.h"
+#include "bitmask.h"
+#include "heldkarp.h"
+#include "batch.h"
 #define INF 1e9
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
-
 // 描画用
 typedef struct
 {
@@ -47,12 +47,15 @@ double min(const double a, const double b) {
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(int n, double **dp, int **next_city, int bit, int v, double dist_table[n][n]);
+double solve(int n, double **dp, int **next_city, int bit, int v, const DistMatrix *dist_table);
 void search_route(int n, int *route, int **next_city, int v, int bit, int idx);
+size_t dp_bytes(int n, size_t budget, int integral, HKCost *kind);
+double solve_tsp(const City *city, const DistMatrix *matrix, int n, int *route, HKCost kind, int num_threads);
+int run_batch(const char *path, int num_threads, size_t budget);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
+City *load_cities(const char* filename,int *n); // 読めなければ NULL
+int load_instance(const char *filename, City **city, DistMatrix *matrix, int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -74,71 +77,224 @@ City *load_cities(const char *filename, int *n)
   FILE *fp;
   if ((fp=fopen(filename,"rb")) == NULL){
     fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
+    return NULL;
+  }
+  // n はファイルの大きさと合っていなければ信用しない (壊れたファイルで巨大な malloc をしない)
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0 || fread(n,sizeof(int),1,fp) != 1 || *n <= 0 ||
+      (uint64_t)st.st_size != sizeof(int) + (uint64_t)*n * sizeof(City)) {
+    fprintf(stderr, "%s: invalid file.\n",filename);
+    fclose(fp);
+    return NULL;
   }
-  fread(n,sizeof(int),1,fp);
   city = (City*)malloc(sizeof(City) * *n);
+  if (city == NULL) {
+    fprintf(stderr, "%s: cannot allocate memory.\n",filename);
+    fclose(fp);
+    return NULL;
+  }
   for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
+    if (fread(&city[i].x, sizeof(int), 1, fp) != 1 || fread(&city[i].y, sizeof(int), 1, fp) != 1) {
+      fprintf(stderr, "%s: invalid file.\n",filename);
+      fclose(fp);
+      free(city);
+      return NULL;
+    }
   }
   fclose(fp);
   return city;
 }
+
+// filename が距離行列ファイル (distmat.h) なら matrix に mmap し (*city = NULL)、そうでなければ町の座標を読む
+// 読めなければ -1
+int load_instance(const char *filename, City **city, DistMatrix *matrix, int *n)
+{
+  *city = NULL;
+  *matrix = (DistMatrix){ .kind = DM_IMPLICIT };
+  if (dm_is_matrix_file(filename)) {
+    if (dm_load(filename, matrix) != 0) return -1;
+    *n = matrix->n;
+    return 0;
+  }
+  *city = load_cities(filename, n);
+  return (*city == NULL) ? -1 : 0;
+}
+// bit DP の解き方
+// ENGINE_ITERATIVE: 町0を含む集合だけのコンパクトな表 (heldkarp.h) を集合の大きい方から順に埋める (既定)
+// ENGINE_RECURSIVE: 2^n * n の dp / next_city 表のメモ化再帰 (以前の実装。結果の確認用)
+enum { ENGINE_ITERATIVE, ENGINE_RECURSIVE };
+static int engine = ENGINE_ITERATIVE;
+
+// 都市数の上限は決めず、表がメモリの予算 (--mem) に収まるかで判断する
+// --cost: コンパクトな表の距離の型。-1 なら予算に収まれば double, 収まらなければ固定小数点
+static int cost_kind = -1;
+static size_t mem_budget = 0; // 0 なら物理メモリの 3/4
+static HKSimd simd_limit = HK_AVX512; // --simd: min-plus のカーネルをこれ以下の命令に制限する (確認用)
+static const char *disk_dir = NULL; // --disk: 表をこのディレクトリのファイルに置く (メモリに収まらない n 用)
+// --checkpoint / --resume: 埋め終えた層をこのディレクトリに書き残す (止められても続きから解ける)
+static const char *ckpt_dir = NULL;
+static int ckpt_resume = 0;      // --resume: ckpt_dir にチェックポイントがあれば続きから解く
+static double ckpt_every = 60;   // --checkpoint-every: 書く間隔 (秒)
+// --metric: 距離の測り方。DM_EUC2D では距離が整数なので、コンパクトな表は既定で倍率1の HK_U32 (正確な int32) にする
+static DistMetric metric = DM_EUCLID;
+
+void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s <city file> [options]\n", prog);
+  fprintf(stderr, "       %s --batch <list file|directory> [options]\n", prog);
+  fprintf(stderr, "  --threads N          threads for the iterative table, 0 = all cores (default: 1)\n");
+  fprintf(stderr, "                       with --batch: number of files solved at once\n");
+  fprintf(stderr, "  --engine iterative|recursive\n");
+  fprintf(stderr, "                       bit DP implementation (default: iterative)\n");
+  fprintf(stderr, "  --metric euclid|euc2d\n");
+  fprintf(stderr, "                       distances: exact Euclidean, or rounded to the nearest\n");
+  fprintf(stderr, "                       integer as in TSPLIB EUC_2D (default: euclid)\n");
+  fprintf(stderr, "  --cost auto|double|float|fixed\n");
+  fprintf(stderr, "                       cost type of the iterative table (default: auto = double\n");
+  fprintf(stderr, "                       if it fits in the memory budget, otherwise fixed;\n");
+  fprintf(stderr, "                       always fixed for euc2d, which is then exact int32)\n");
+  fprintf(stderr, "  --simd auto|avx2|scalar\n");
+  fprintf(stderr, "                       widest min-plus kernel to use (default: auto)\n");
+  fprintf(stderr, "  --mem MB             memory budget for the table (default: 3/4 of RAM,\n");
+  fprintf(stderr, "                       shared by the --batch threads)\n");
+  fprintf(stderr, "  --disk DIR           keep the iterative table in memory-mapped files under DIR,\n");
+  fprintf(stderr, "                       one file per layer (default cost: fixed)\n");
+  fprintf(stderr, "  --checkpoint DIR     save finished layers of the iterative table to DIR in the\n");
+  fprintf(stderr, "                       background (removed when the solve finishes)\n");
+  fprintf(stderr, "  --resume DIR         like --checkpoint, but continue from the checkpoint in DIR\n");
+  fprintf(stderr, "                       if there is one\n");
+  fprintf(stderr, "  --checkpoint-every SEC\n");
+  fprintf(stderr, "                       minimum interval between checkpoints (default: 60)\n");
+  exit(1);
+}
+
+long load_long(const char *argvalue)
+{
+  char *e;
+  errno = 0;
+  const long nl = strtol(argvalue, &e, 10);
+  if (errno == ERANGE) {
+    fprintf(stderr, "%s: %s\n", argvalue, strerror(errno));
+    exit(1);
+  }
+  if (*e != '\0') {
+    fprintf(stderr, "irregular character %s found in %s\n", e, argvalue);
+    exit(1);
+  }
+  return nl;
+}
+
 int main(int argc, char**argv)
 {
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 20; // 100から20に変更
+
+  const char *filename = NULL;
+  const char *batch_path = NULL; // --batch <list file|directory>: 複数のファイルをまとめて解く (描画も待ちもしない)
+  int num_threads = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      if (filename != NULL) usage(argv[0]);
+      filename = argv[i];
+      continue;
+    }
+    if (i + 1 == argc) usage(argv[0]);
+    const char *opt = argv[i];
+    const char *val = argv[++i];
+    if (strcmp(opt, "--batch") == 0) batch_path = val;
+    else if (strcmp(opt, "--threads") == 0) {
+      num_threads = (int)load_long(val);
+      if (num_threads < 0) usage(argv[0]);
+      if (num_threads == 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      if (num_threads < 1) num_threads = 1;
+    }
+    else if (strcmp(opt, "--engine") == 0) {
+      if (strcmp(val, "iterative") == 0) engine = ENGINE_ITERATIVE;
+      else if (strcmp(val, "recursive") == 0) engine = ENGINE_RECURSIVE;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--cost") == 0) {
+      if (strcmp(val, "auto") == 0) cost_kind = -1;
+      else if (strcmp(val, "double") == 0) cost_kind = HK_F64;
+      else if (strcmp(val, "float") == 0) cost_kind = HK_F32;
+      else if (strcmp(val, "fixed") == 0) cost_kind = HK_U32;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--metric") == 0) {
+      if (strcmp(val, "euclid") == 0) metric = DM_EUCLID;
+      else if (strcmp(val, "euc2d") == 0) metric = DM_EUC2D;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--simd") == 0) {
+      if (strcmp(val, "auto") == 0) simd_limit = HK_AVX512;
+      else if (strcmp(val, "avx2") == 0) simd_limit = HK_AVX2;
+      else if (strcmp(val, "scalar") == 0) simd_limit = HK_SCALAR;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--disk") == 0) {
+      disk_dir = val;
+    }
+    else if (strcmp(opt, "--checkpoint") == 0 || strcmp(opt, "--resume") == 0) {
+      ckpt_dir = val;
+      ckpt_resume = (strcmp(opt, "--resume") == 0);
+    }
+    else if (strcmp(opt, "--checkpoint-every") == 0) {
+      char *e;
+      ckpt_every = strtod(val, &e);
+      if (e == val || *e != '\0' || !(ckpt_every >= 0)) usage(argv[0]); // NaN も弾く
+    }
+    else if (strcmp(opt, "--mem") == 0) {
+      const long mb = load_long(val);
+      if (mb <= 0 || mb > (long)(SIZE_MAX >> 20)) usage(argv[0]);
+      mem_budget = (size_t)mb << 20;
+    }
+    else usage(argv[0]);
+  }
+  if ((disk_dir != NULL || ckpt_dir != NULL) && engine == ENGINE_RECURSIVE) usage(argv[0]);
+  if (ckpt_dir != NULL && batch_path != NULL) usage(argv[0]);
+  if (mem_budget == 0) mem_budget = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 4 * 3;
+  if (batch_path != NULL) {
+    if (filename != NULL) usage(argv[0]);
+    return run_batch(batch_path, num_threads, mem_budget / num_threads);
+  }
+  if (filename == NULL) usage(argv[0]);
 
   Map map = init_map(width, height);
   
   FILE *fp = stdout; // とりあえず描画先は標準出力としておく
-  if (argc != 2){
-    fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
-    exit(1);
-  }
   int n;
 
-  City *city = load_cities(argv[1],&n);
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
-  
-  double dist_table[n][n];
-  for (int i = 0; i < n; i++) {
-    for (int j = 0; j < n; j++) {
-      dist_table[i][j] = distance(city[i], city[j]); // bitDPのために距離のテーブルをセット
-    } 
+  City *city;
+  DistMatrix matrix; // 距離行列ファイルのとき (city は NULL)
+  if (load_instance(filename, &city, &matrix, &n) != 0) exit(1);
+  HKCost kind = HK_F64;
+  const size_t bytes = dp_bytes(n, mem_budget, city == NULL && matrix.kind == DM_FULL_I32, &kind);
+  if (bytes > mem_budget) {
+    if (n < 2 || n > hk_max_n) fprintf(stderr, "%s: n = %d is out of range (2 to %d cities)\n", filename, n, hk_max_n);
+    else fprintf(stderr, "%s: n = %d needs %zu MB for the DP table (budget %zu MB, see --mem)\n",
+                 filename, n, bytes >> 20, mem_budget >> 20);
+    exit(1);
   }
   
-  // 町の初期配置を表示
-  plot_cities(fp, map, city, n, NULL);
-  sleep(1);
+  // 町の初期配置を表示 (距離行列には座標がないので描かない)
+  if (city != NULL) {
+    plot_cities(fp, map, city, n, NULL);
+    sleep(1);
+  }
 
   // 訪れる順序を記録する配列を設定
   int *route = (int*)calloc(n, sizeof(int));
   // 訪れた町を記録するフラグ
   // int *visited = (int*)calloc(n, sizeof(int));
 
-  double **dp = (double**)calloc((1<<n)+1, sizeof(double*)); // {(1<<n) + 1} * (n+1)の二次元配列
-  double *tmp = (double*)calloc((1<<n + 1) * (n + 1) , sizeof(double));
-  
-  int **next_city = (int**)calloc((1<<n)+1, sizeof(int*));
-  int *tmp_city = (int*)calloc((1<<n + 1) * (n + 1), sizeof(int));
-  
-  for (int i = 0; i < (1<<n)+1; i++) {
-    dp[i] = tmp + (n+1) * i;
-    next_city[i] = tmp_city + (n+1) * i;
-  }
-  
-  for (int i = 0; i < (1<<n); i++) {
-    for (int j = 0; j < n; j++) dp[i][j] = -1; // 未探索のフラグ
+  double d = solve_tsp(city, (city == NULL) ? &matrix : NULL, n, route, kind, num_threads);
+  if (d < 0) {
+    fprintf(stderr, "cannot build the DP table.\n");
+    exit(1);
   }
-
-  double d = solve(n, dp, next_city, 0, 0, dist_table);
-  search_route(n, route, next_city, 0, 0, 0);
   
-  plot_cities(fp, map, city, n, route);
+  if (city != NULL) plot_cities(fp, map, city, n, route);
   printf("total distance = %f\n", d);
   for (int i = 0 ; i < n ; i++){
     printf("%d -> ", route[i]);
@@ -149,23 +305,216 @@ int main(int argc, char**argv)
   free(route);
   // free(visited);
   free(city);
+  dm_free(&matrix);
+  free_map_dot(map);
+  return 0;
+}
 
-  free(tmp);
-  free(dp);
+// engine と --cost で n 都市を解くときの表のバイト数 (解けない n なら SIZE_MAX)
+// kind にはコンパクトな表で使う距離の型を返す。integral は距離がすべて整数の行列を読んだとき 1
+size_t dp_bytes(int n, size_t budget, int integral, HKCost *kind)
+{
+  if (n < 2 || n > hk_max_n) return SIZE_MAX;
+  if (engine == ENGINE_RECURSIVE) {
+    // dp (double) と next_city (int) が 2^n * n 要素ずつ, 行へのポインタが 2^n 個ずつ
+    if (n > 30) return SIZE_MAX;
+    return ((size_t)1 << n) * (n * (sizeof(double) + sizeof(int)) + sizeof(double*) + sizeof(int*));
+  }
+  if (disk_dir != NULL) {
+    // メモリに置くのは距離表だけ。層のファイルの大きさは hk_solve_disk が空き容量と比べる
+    *kind = (cost_kind >= 0) ? (HKCost)cost_kind : HK_U32;
+    return ((size_t)n * n + n * hk_stride(n)) * hk_cost_size(*kind);
+  }
+  if (cost_kind >= 0) *kind = (HKCost)cost_kind;
+  else if (metric == DM_EUC2D || integral) *kind = HK_U32;
+  else *kind = (hk_bytes(n, HK_F64) <= budget) ? HK_F64 : HK_U32;
+  return hk_bytes(n, *kind);
+}
 
-  free(tmp_city);
-  free(next_city);
-  return 0;
+// 1つのインスタンスを bit DP で解き、route に巡回順 (route[0] = 0) を入れて距離を返す
+// 表を確保できなければ (--disk ではファイルを作れなければ) -1 を返す
+// 距離は route から倍精度で計算し直す (float や固定小数点の表を使った場合も正確な値にする。--metric の測り方で)
+// コンパクトな表は num_threads 本のスレッドで層ごとに埋める (再帰版は1スレッド)
+// matrix が NULL でなければ、city の代わりに距離行列ファイルの距離で解く (非対称でもよい。d(v,u) は v から u)
+// --checkpoint / --resume ではチェックポイントを書き、解き終えたら消す (失敗したときは残す)
+double solve_tsp(const City *city, const DistMatrix *matrix, int n, int *route, HKCost kind, int num_threads)
+{
+  // bitDPのために距離のテーブルをセット (ヒープ上に64バイト境界で確保する)
+  DistMatrix dist_table = (matrix != NULL) ? dm_copy_f64(matrix) : dm_build(city, n, DM_FULL_F64, metric, (size_t)-1);
+  if (dist_table.data == NULL) return -1;
+
+  if (engine == ENGINE_RECURSIVE) {
+    const size_t rows = (size_t)1 << n;
+    double **dp = (double**)malloc(rows * sizeof(double*)); // 2^n * n の二次元配列
+    double *tmp = (double*)malloc(rows * n * sizeof(double));
+    int **next_city = (int**)malloc(rows * sizeof(int*));
+    int *tmp_city = (int*)malloc(rows * n * sizeof(int));
+    if (dp == NULL || tmp == NULL || next_city == NULL || tmp_city == NULL) {
+      free(dp);
+      free(tmp);
+      free(next_city);
+      free(tmp_city);
+      dm_free(&dist_table);
+      return -1;
+    }
+    for (size_t i = 0; i < rows; i++) {
+      dp[i] = tmp + n * i;
+      next_city[i] = tmp_city + n * i;
+      for (int j = 0; j < n; j++) dp[i][j] = -1; // 未探索のフラグ
+    }
+    // 町0から出発するので、町0を訪れた状態 (bit = 1, v = 0) から始める
+    solve(n, dp, next_city, 1, 0, &dist_table);
+    route[0] = 0;
+    search_route(n, route, next_city, 0, 1, 0);
+    free(tmp);
+    free(dp);
+    free(tmp_city);
+    free(next_city);
+  }
+  else if (disk_dir != NULL) {
+    HeldKarp hk;
+    if (hk_init_dist(&hk, &dist_table, n, kind) != 0) {
+      dm_free(&dist_table);
+      return -1;
+    }
+    if (hk.simd > simd_limit) hk.simd = simd_limit;
+    HKCheckpoint ck;
+    if (ckpt_dir != NULL && hk_ckpt_open(&ck, &hk, ckpt_dir, ckpt_resume, ckpt_every, 1) != 0) {
+      hk_free(&hk);
+      dm_free(&dist_table);
+      return -1;
+    }
+    const int status = hk_solve_disk(&hk, disk_dir, num_threads, route, (ckpt_dir != NULL) ? &ck : NULL);
+    if (ckpt_dir != NULL) hk_ckpt_close(&ck, status == 0);
+    hk_free(&hk);
+    if (status != 0) {
+      dm_free(&dist_table);
+      return -1;
+    }
+  }
+  else {
+    HeldKarp hk;
+    if (hk_init(&hk, &dist_table, n, kind) != 0) {
+      dm_free(&dist_table);
+      return -1;
+    }
+    if (hk.simd > simd_limit) hk.simd = simd_limit;
+    HKCheckpoint ck;
+    if (ckpt_dir != NULL && hk_ckpt_open(&ck, &hk, ckpt_dir, ckpt_resume, ckpt_every, 0) != 0) {
+      hk_free(&hk);
+      dm_free(&dist_table);
+      return -1;
+    }
+    hk_solve(&hk, num_threads, (ckpt_dir != NULL) ? &ck : NULL);
+    if (ckpt_dir != NULL) hk_ckpt_close(&ck, 1);
+    hk_route(&hk, route);
+    hk_free(&hk);
+  }
+
+  double d = 0;
+  for (int i = 0; i < n; i++) d += dm_get(&dist_table, route[i], route[(i+1) % n]);
+  dm_free(&dist_table);
+  return d;
+}
+
+// --batch: ファイルを num_threads 本のスレッドで1つずつ取って解き、解き終わった順に1行ずつ表示する
+typedef struct
+{
+  char **files;
+  int num_files;
+  int next;             // 次に解くファイルの番号
+  size_t budget;        // 1つのファイルを解くときのメモリの予算
+  int num_failed;
+  pthread_mutex_t lock; // 出力と num_failed を守る
+} Batch;
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *batch_worker(void *arg)
+{
+  Batch *b = (Batch*)arg;
+  int k;
+  while ((k = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->num_files) {
+    const double start = now_sec();
+    int n;
+    City *city;
+    DistMatrix matrix;
+    const int loaded = (load_instance(b->files[k], &city, &matrix, &n) == 0);
+    HKCost kind = HK_F64;
+    const size_t bytes = loaded ? dp_bytes(n, b->budget, city == NULL && matrix.kind == DM_FULL_I32, &kind) : 0;
+    int ok = (loaded && bytes <= b->budget);
+    double d = 0;
+    if (ok) {
+      int *route = (int*)malloc(sizeof(int) * n);
+      d = solve_tsp(city, (city == NULL) ? &matrix : NULL, n, route, kind, 1);
+      ok = (d >= 0);
+      free(route);
+    }
+    const double elapsed = now_sec() - start;
+
+    pthread_mutex_lock(&b->lock);
+    if (ok) printf("%s: total distance = %f (n = %d, %.3f s)\n", b->files[k], d, n, elapsed);
+    else {
+      if (!loaded) printf("%s: failed\n", b->files[k]);
+      else if (bytes == SIZE_MAX) printf("%s: failed (n = %d, 2 to %d cities)\n", b->files[k], n, hk_max_n);
+      else if (bytes > b->budget) printf("%s: failed (n = %d needs %zu MB, budget %zu MB)\n", b->files[k], n,
+                                         bytes >> 20, b->budget >> 20);
+      else printf("%s: failed (cannot build the DP table)\n", b->files[k]);
+      b->num_failed++;
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&b->lock);
+    free(city);
+    dm_free(&matrix);
+  }
+  return NULL;
+}
+
+int run_batch(const char *path, int num_threads, size_t budget)
+{
+  Batch b = { .next = 0, .budget = budget, .num_failed = 0 };
+  b.files = batch_list(path, &b.num_files);
+  if (b.files == NULL) {
+    fprintf(stderr, "%s: cannot open.\n", path);
+    return EXIT_FAILURE;
+  }
+  pthread_mutex_init(&b.lock, NULL);
+  if (num_threads > b.num_files) num_threads = (b.num_files > 0) ? b.num_files : 1;
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (int t = 1; t < num_threads; t++) {
+    const int err = pthread_create(&threads[t], NULL, batch_worker, &b);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  batch_worker(&b);
+  for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+  pthread_mutex_destroy(&b.lock);
+  free(threads);
+  batch_free(b.files, b.num_files);
+  return (b.num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-// 繋がっている都市間に線を引く
+// 地図の中の点か (gencity に幅と高さを渡すと、町が描画の範囲の外に出ることがある)
+static inline int in_map(Map map, int x, int y)
+{
+  return 0 <= x && x < map.width && 0 <= y && y < map.height;
+}
+
+// 繋がっている都市間に線を引く (地図の外の部分は描かない)
 void draw_line(Map map, City a, City b)
 {
   const int n = max(abs(a.x - b.x), abs(a.y - b.y));
   for (int i = 1 ; i <= n ; i++){
     const int x = a.x + i * (b.x - a.x) / n;
     const int y = a.y + i * (b.y - a.y) / n;
-    if (map.dot[x][y] == ' ') map.dot[x][y] = '*';
+    if (in_map(map, x, y) && map.dot[x][y] == ' ') map.dot[x][y] = '*';
   }
 }
 
@@ -193,7 +542,7 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
     for (int j = 0; j < strlen(buf); j++) {
       const int x = city[i].x + j;
       const int y = city[i].y;
-      map.dot[x][y] = buf[j];
+      if (in_map(map, x, y)) map.dot[x][y] = buf[j];
     }
   }
 
@@ -209,33 +558,28 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
-{
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
-}
-
-double solve(int n, double **dp, int **next_city, int bit, int v, double dist_table[n][n])
+// dp[bit][v]: 集合 bit の町を訪れて町vにいるとき、残りの町をすべて回って町0に戻るまでの最短距離
+// next_city[bit][v]: そのときに次に訪れる町
+double solve(int n, double **dp, int **next_city, int bit, int v, const DistMatrix *dist_table)
 {
   if (dp[bit][v] >= 0) return dp[bit][v];
 
-  if (bit == (1<<n)-1 && v == 0) return dp[bit][v] = 0;
+  if (bit == (1<<n)-1) return dp[bit][v] = dm_row(dist_table, v)[0]; // 全部回ったので町0に戻る
 
   // int prev_bit = bit & ~(1<<v);
 
   double ret = INF;
 
-  for (int u = 0; u < n; u++) {
-    if (!(bit >> u & 1)) {
-      // 次の頂点はu
-      int next = bit | (1 << u);
-      double now = solve(n, dp, next_city, next, u, dist_table) + dist_table[u][v];
-      // ret = min(ret, now);
-      if (ret > now) {
-        ret = now;
-        next_city[bit][v] = u;
-      }
+  // まだ訪れていない町だけを、番号の小さい順に1つずつ取り出す
+  for (uint32_t rest = ~(uint32_t)bit & (((uint32_t)1 << n) - 1); rest != 0; rest = bm_drop_lowest(rest)) {
+    // 次の頂点はu
+    const int u = bm_lowest(rest);
+    int next = bit | (1 << u);
+    double now = solve(n, dp, next_city, next, u, dist_table) + dm_row(dist_table, v)[u]; // v から u へ
+    // ret = min(ret, now);
+    if (ret > now) {
+      ret = now;
+      next_city[bit][v] = u;
     }
   }
   return dp[bit][v] = ret;
@@ -249,6 +593,5 @@ void search_route(int n, int *route, int **next_city, int v, int bit, int idx) {
   route[idx+1] = next_city[bit][v];
   int nv = route[idx+1];
   int next_bit = bit | (1 << nv);
-  printf("%d ", nv);
   search_route(n, route, next_city, nv, next_bit, idx+1);
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// --batch 用: 解くファイルの一覧を作る
+// path がディレクトリなら、その中の .dat ファイルを名前順に並べる
+// そうでなければ、1行に1つずつファイル名を書いたリストとして読む (空行と # で始まる行は飛ばす)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static int batch_cmp_name(const void *x, const void *y)
+{
+  return strcmp(*(char* const*)x, *(char* const*)y);
+}
+
+static void batch_push(char ***files, int *num, int *cap, char *name)
+{
+  if (*num == *cap) {
+    *cap = (*cap == 0) ? 64 : *cap * 2;
+    *files = (char**)realloc(*files, sizeof(char*) * *cap);
+  }
+  (*files)[(*num)++] = name;
+}
+
+// 読めなければ NULL を返す
+static char **batch_list(const char *path, int *num)
+{
+  char **files = NULL;
+  int cap = 0;
+  *num = 0;
+  struct stat st;
+  if (stat(path, &st) != 0) return NULL;
+
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return NULL;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+      const size_t len = strlen(e->d_name);
+      if (len < 4 || strcmp(e->d_name + len - 4, ".dat") != 0) continue;
+      char *name = (char*)malloc(strlen(path) + len + 2);
+      sprintf(name, "%s/%s", path, e->d_name);
+      batch_push(&files, num, &cap, name);
+    }
+    closedir(dir);
+    if (*num > 0) qsort(files, *num, sizeof(char*), batch_cmp_name);
+  }
+  else {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return NULL;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] == '\0' || line[0] == '#') continue;
+      batch_push(&files, num, &cap, strdup(line));
+    }
+    fclose(fp);
+  }
+  if (files == NULL) files = (char**)malloc(sizeof(char*)); // 空のリスト
+  return files;
+}
+
+static void batch_free(char **files, int num)
+{
+  for (int i = 0; i < num; i++) free(files[i]);
+  free(files);
+}
+
+#endif
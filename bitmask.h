@@ -0,0 +1,100 @@
+#ifndef BITMASK_H
+#define BITMASK_H
+
+// 町の集合を uint32_t のビット (町 u が u ビット目) で持つときの道具 (bit DP 用)
+//
+// 集合の要素を小さい順に取り出すときは、全部の町を調べて if で飛ばさずに
+//   for (uint32_t rest = set; rest != 0; rest = bm_drop_lowest(rest)) { const int u = bm_lowest(rest); ... }
+// とする。回数は要素の数だけで、外れる分岐もない (BMI があれば tzcnt と blsr の2命令になる)
+// まだ訪れていない町は bm_drop_lowest をかける前に ~bit & full を作ればよい
+//
+// 要素を k 個持つ集合 (層) は、bm_first_subset(k) から bm_next_subset で小さい順に並べられる (Gosper の方法)
+// 層の中での番号 (小さい順に 0, 1, ...) は bm_rank, 番号から集合に戻すのは bm_unrank
+// 番号は combinadic: ビットの位置を b_0 < b_1 < ... として sum_j C(b_j, j+1)。8ビットずつの表で4回の足し算で求める
+// 表は最初に bm_init を呼んだときに1度だけ作る (どのスレッドから呼んでもよい)
+
+#include <stdint.h>
+#include <pthread.h>
+
+static inline int bm_lowest(uint32_t x)
+{
+  return __builtin_ctz(x);
+}
+
+static inline uint32_t bm_drop_lowest(uint32_t x)
+{
+  return x & (x - 1);
+}
+
+// 要素を k 個持ついちばん小さい集合 (k < 32)
+static inline uint32_t bm_first_subset(int k)
+{
+  return ((uint32_t)1 << k) - 1;
+}
+
+// 同じ数のビットを持つ次に大きい数 (Gosper の方法。割り算の代わりに最下位ビットの位置だけずらす)
+static inline uint32_t bm_next_subset(uint32_t x)
+{
+  const uint32_t r = x + (x & -x);
+  return (((r ^ x) >> 2) >> bm_lowest(x)) | r;
+}
+
+static uint32_t bm_binom[33][33];          // bm_binom[a][b] = C(a, b)
+static uint32_t bm_rank_byte[4][256][33];  // [p][x][j]: p バイト目が x で、それより下に j 個のビットがあるときの和
+static pthread_once_t bm_tables_once = PTHREAD_ONCE_INIT;
+
+static void bm_build_tables(void)
+{
+  for (int a = 0; a <= 32; a++) {
+    for (int b = 0; b <= 32; b++) {
+      bm_binom[a][b] = (b == 0) ? 1 : (a == 0) ? 0 : bm_binom[a-1][b-1] + bm_binom[a-1][b];
+    }
+  }
+  for (int p = 0; p < 4; p++) {
+    for (int x = 0; x < 256; x++) {
+      for (int j = 0; j <= 32; j++) {
+        uint32_t r = 0;
+        int i = j;
+        for (uint32_t rest = x; rest != 0; rest = bm_drop_lowest(rest)) {
+          i++;
+          if (i <= 32) r += bm_binom[8 * p + bm_lowest(rest)][i];
+        }
+        bm_rank_byte[p][x][j] = r;
+      }
+    }
+  }
+}
+
+static inline void bm_init(void)
+{
+  pthread_once(&bm_tables_once, bm_build_tables);
+}
+
+// 層の中での番号 (bm_init のあとで使う)
+static inline uint32_t bm_rank(uint32_t mask)
+{
+  uint32_t r = 0;
+  int j = 0;
+  for (int p = 0; p < 4; p++) {
+    const uint32_t x = mask >> (8 * p) & 255;
+    r += bm_rank_byte[p][x][j];
+    j += __builtin_popcount(x);
+  }
+  return r;
+}
+
+// 要素を k 個持つ m ビットの集合のうち r 番目 (bm_init のあとで使う)
+static inline uint32_t bm_unrank(uint32_t r, int k, int m)
+{
+  uint32_t mask = 0;
+  for (int b = m - 1; k > 0; b--) {
+    if (bm_binom[b][k] <= r) {
+      mask |= (uint32_t)1 << b;
+      r -= bm_binom[b][k];
+      k--;
+    }
+  }
+  return mask;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CITY_H
+#define CITY_H
+
+#include <math.h>
+
+// 町の構造体（今回は2次元座標）を定義
+typedef struct
+{
+  int x;
+  int y;
+} City;
+
+// 2地点間の距離を計算
+static inline double distance(City a, City b)
+{
+  const double dx = a.x - b.x;
+  const double dy = a.y - b.y;
+  return sqrt(dx * dx + dy * dy);
+}
+
+// TSPLIB の EUC_2D: ユークリッド距離を最も近い整数に丸めたもの
+static inline int distance_euc2d(City a, City b)
+{
+  return (int)(distance(a, b) + 0.5);
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef DISTMAT_H
+#define DISTMAT_H
+
+// 町の間の距離表 (tsp1.c と advance_tsp_bitDP.c で共用)
+// 町の配置は実行中に変わらないので、インスタンスごとに1度だけ作り、探索中の sqrt をなくす
+//
+// DM_FULL_F64 / DM_FULL_F32: n * n の表。各行を64バイト境界にそろえる
+// DM_TRI_F64 / DM_TRI_F32:   上三角 (i < j) だけを詰めた表。メモリは半分になる
+// DM_FULL_I32 / DM_TRI_I32:  int32_t の表 (DM_EUC2D の距離は整数なので、丸めずに半分のメモリで持てる)
+// DM_IMPLICIT:               表を持たず、その都度座標から計算する (メモリ上限を超えたとき)
+//
+// 距離の測り方 (DistMetric) は2通り
+// DM_EUCLID: ユークリッド距離 (double)
+// DM_EUC2D:  TSPLIB の EUC_2D (整数に丸めたユークリッド距離)。巡回路の長さも整数になり、比較が正確になる
+//
+// 座標の代わりに、あらかじめ計算した距離 (道路の所要時間など) を距離行列ファイルで渡すこともできる
+//   0: "TSPDIST\0" (8バイト)
+//   8: int32 n
+//  12: int32 値の型 (DM_FILE_F32 = 0: float, DM_FILE_I32 = 1: int32)
+//  16: n * n 個の値 (0 以上)。行優先で、[i * n + j] が町 i から町 j への距離 (対称でなくてもよい)
+// dm_load は mmap した表を1度だけ走査して、負の値や NaN がないことを確かめる (表はコピーしない)
+// 読んだ表は stride = n の DM_FULL_F32 / DM_FULL_I32 になり、city は NULL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "city.h"
+
+typedef enum
+{
+  DM_IMPLICIT,
+  DM_FULL_F64,
+  DM_FULL_F32,
+  DM_TRI_F64,
+  DM_TRI_F32,
+  DM_FULL_I32,
+  DM_TRI_I32,
+} DistKind;
+
+typedef enum
+{
+  DM_EUCLID,
+  DM_EUC2D,
+} DistMetric;
+
+typedef struct
+{
+  int n;
+  DistKind kind;
+  DistMetric metric;
+  size_t stride;    // FULL のときの1行の要素数 (パディング込み)
+  void *data;
+  const City *city; // DM_IMPLICIT のときに使う座標
+  void *map;        // dm_load で mmap した領域 (NULL でなければ dm_free で munmap する)
+  size_t map_bytes;
+} DistMatrix;
+
+#define DM_FILE_MAGIC "TSPDIST"
+
+enum { DM_FILE_F32 = 0, DM_FILE_I32 = 1 };
+
+typedef struct
+{
+  char magic[8];
+  int32_t n;
+  int32_t type;
+} DistFileHeader;
+
+static inline size_t dm_elem_size(DistKind kind)
+{
+  return (kind == DM_FULL_F64 || kind == DM_TRI_F64) ? sizeof(double) : 4;
+}
+
+static inline int dm_is_full(DistKind kind)
+{
+  return kind == DM_FULL_F64 || kind == DM_FULL_F32 || kind == DM_FULL_I32;
+}
+
+// metric で測った2地点間の距離
+static inline double dm_distance(DistMetric metric, City a, City b)
+{
+  return (metric == DM_EUC2D) ? distance_euc2d(a, b) : distance(a, b);
+}
+
+static inline size_t dm_tri_index(int n, int i, int j)
+{
+  return (size_t)i * (2 * (size_t)n - i - 1) / 2 + (j - i - 1);
+}
+
+// 表を作るのに必要なバイト数
+static inline size_t dm_bytes(int n, DistKind kind)
+{
+  if (kind == DM_IMPLICIT) return 0;
+  const size_t es = dm_elem_size(kind);
+  if (dm_is_full(kind)) {
+    const size_t per_line = 64 / es;
+    const size_t stride = (n + per_line - 1) / per_line * per_line;
+    return stride * n * es;
+  }
+  return (size_t)n * (n - 1) / 2 * es;
+}
+
+// metric で測った kind の表を作る。mem_limit バイトを超える場合は DM_IMPLICIT になる
+// DM_FULL_I32 / DM_TRI_I32 は DM_EUC2D でしか使えない (ユークリッド距離は整数にならない)
+static inline DistMatrix dm_build(const City *city, int n, DistKind kind, DistMetric metric, size_t mem_limit)
+{
+  DistMatrix dm = { .n = n, .kind = kind, .metric = metric, .stride = 0, .data = NULL, .city = city };
+  const size_t bytes = dm_bytes(n, kind);
+  if (kind == DM_IMPLICIT || bytes > mem_limit || bytes == 0) {
+    dm.kind = DM_IMPLICIT;
+    return dm;
+  }
+  if (posix_memalign(&dm.data, 64, bytes) != 0) {
+    fprintf(stderr, "cannot allocate distance matrix (%zu bytes).\n", bytes);
+    dm.kind = DM_IMPLICIT;
+    dm.data = NULL;
+    return dm;
+  }
+
+  if (dm_is_full(kind)) {
+    dm.stride = bytes / n / dm_elem_size(kind);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        const double d = dm_distance(metric, city[i], city[j]);
+        if (kind == DM_FULL_F64) ((double*)dm.data)[i * dm.stride + j] = d;
+        else if (kind == DM_FULL_F32) ((float*)dm.data)[i * dm.stride + j] = (float)d;
+        else ((int32_t*)dm.data)[i * dm.stride + j] = (int32_t)d;
+      }
+    }
+  }
+  else {
+    size_t k = 0;
+    for (int i = 0; i < n; i++) {
+      for (int j = i + 1; j < n; j++, k++) {
+        const double d = dm_distance(metric, city[i], city[j]);
+        if (kind == DM_TRI_F64) ((double*)dm.data)[k] = d;
+        else if (kind == DM_TRI_F32) ((float*)dm.data)[k] = (float)d;
+        else ((int32_t*)dm.data)[k] = (int32_t)d;
+      }
+    }
+  }
+  return dm;
+}
+
+static inline double dm_get(const DistMatrix *dm, int i, int j)
+{
+  switch (dm->kind) {
+  case DM_FULL_F64:
+    return ((const double*)dm->data)[i * dm->stride + j];
+  case DM_FULL_F32:
+    return ((const float*)dm->data)[i * dm->stride + j];
+  case DM_FULL_I32:
+    return ((const int32_t*)dm->data)[i * dm->stride + j];
+  case DM_TRI_F64:
+  case DM_TRI_F32:
+  case DM_TRI_I32:
+    if (i == j) return 0;
+    if (i > j) {
+      const int tmp = i;
+      i = j;
+      j = tmp;
+    }
+    if (dm->kind == DM_TRI_F64) return ((const double*)dm->data)[dm_tri_index(dm->n, i, j)];
+    if (dm->kind == DM_TRI_F32) return ((const float*)dm->data)[dm_tri_index(dm->n, i, j)];
+    return ((const int32_t*)dm->data)[dm_tri_index(dm->n, i, j)];
+  default:
+    return dm_distance(dm->metric, dm->city[i], dm->city[j]);
+  }
+}
+
+// DM_FULL_F64 の i 行目 (64バイト境界にそろっている)
+static inline const double *dm_row(const DistMatrix *dm, int i)
+{
+  return (const double*)dm->data + i * dm->stride;
+}
+
+// src と同じ値の DM_FULL_F64 の表を作る (dm_row で行を読みたいとき用)。確保できなければ data が NULL になる
+static inline DistMatrix dm_copy_f64(const DistMatrix *src)
+{
+  const int n = src->n;
+  DistMatrix dm = { .n = n, .kind = DM_FULL_F64, .metric = src->metric, .city = src->city };
+  const size_t bytes = dm_bytes(n, DM_FULL_F64);
+  if (posix_memalign(&dm.data, 64, bytes) != 0) {
+    dm.data = NULL;
+    return dm;
+  }
+  dm.stride = bytes / n / sizeof(double);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) ((double*)dm.data)[i * dm.stride + j] = dm_get(src, i, j);
+  }
+  return dm;
+}
+
+// 先頭が距離行列ファイルの印なら 1
+static inline int dm_is_matrix_file(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) return 0;
+  char magic[8];
+  const int ok = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, DM_FILE_MAGIC, 8) == 0);
+  fclose(fp);
+  return ok;
+}
+
+// 距離行列ファイルを mmap して dm にする。読めなければメッセージを出して -1
+static inline int dm_load(const char *path, DistMatrix *dm)
+{
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  DistFileHeader h;
+  if (fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+      memcmp(h.magic, DM_FILE_MAGIC, 8) != 0 || h.n <= 1 || (h.type != DM_FILE_F32 && h.type != DM_FILE_I32) ||
+      (uint64_t)st.st_size != sizeof(h) + (uint64_t)h.n * h.n * 4) {
+    fprintf(stderr, "%s: invalid distance matrix file.\n", path);
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+    return -1;
+  }
+  // 探索と下界は距離が 0 以上であることを前提にするので、負の値と NaN は受け付けない
+  const size_t count = (size_t)h.n * h.n;
+  const float *vf = (const float*)((char*)map + sizeof(h));
+  const int32_t *vi = (const int32_t*)((char*)map + sizeof(h));
+  for (size_t k = 0; k < count; k++) {
+    if ((h.type == DM_FILE_F32) ? !(vf[k] >= 0) : vi[k] < 0) {
+      fprintf(stderr, "%s: invalid file.\n", path);
+      munmap(map, st.st_size);
+      return -1;
+    }
+  }
+  *dm = (DistMatrix){ .n = h.n, .kind = (h.type == DM_FILE_F32) ? DM_FULL_F32 : DM_FULL_I32,
+                      .metric = DM_EUCLID, .stride = h.n, .data = (char*)map + sizeof(h), .city = NULL,
+                      .map = map, .map_bytes = st.st_size };
+  return 0;
+}
+
+// d(i,j) = d(j,i) がすべての町の組で成り立てば 1
+static inline int dm_symmetric(const DistMatrix *dm)
+{
+  for (int i = 0; i < dm->n; i++) {
+    for (int j = i + 1; j < dm->n; j++) {
+      if (dm_get(dm, i, j) != dm_get(dm, j, i)) return 0;
+    }
+  }
+  return 1;
+}
+
+static inline void dm_free(DistMatrix *dm)
+{
+  if (dm->map != NULL) munmap(dm->map, dm->map_bytes);
+  else free(dm->data);
+  dm->data = NULL;
+  dm->map = NULL;
+  dm->kind = DM_IMPLICIT;
+}
+
+#endif
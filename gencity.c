@@ -6,6 +6,7 @@
 #include <string.h> // strerror()
 #include <errno.h> // errno, ERANGE
 #include <assert.h> // assert()
+#include "rng.h"
 
 int load_int(const char *argvalue)
 {
@@ -27,23 +28,29 @@ int load_int(const char *argvalue)
 
 int main(int argc, char **argv)
 {
-  const int width = 70;
-  const int height = 40;
-  const int max_cities = 100;
+  // 描画できる大きさが既定値。大きなインスタンスでは width, height を指定する
+  int width = 70;
+  int height = 40;
 
-  if(argc != 4){
-    fprintf(stderr, "usage: %s <number of cities> <random seed> <outputfilename>\n",argv[0]);
+  if(argc != 4 && argc != 6){
+    fprintf(stderr, "usage: %s <number of cities> <random seed> <outputfilename> [<width> <height>]\n",argv[0]);
     return EXIT_FAILURE;
   }
   int nc = load_int(argv[1]);
-  assert( nc > 1 && nc <= max_cities);
+  assert( nc > 1);
+  if (argc == 6) {
+    width = load_int(argv[4]);
+    height = load_int(argv[5]);
+    assert( width > 10 && height > 10);
+  }
   int seed = load_int(argv[2]);
-  srand(seed);
+  Rng rng; // rand() と違って処理系によらず、同じシードなら同じ町になる
+  rng_init(&rng, seed);
 
   int *data = (int*)malloc(sizeof(int)*2*nc);
   for (int i = 0 ; i < nc ; i++){
-    data[2*i] = rand() % (width - 10) + 5;;
-    data[2*i+1] = rand() % (height - 10) + 5;;
+    data[2*i] = rng_below(&rng, width - 10) + 5;
+    data[2*i+1] = rng_below(&rng, height - 10) + 5;
   }
 
   FILE *fp;
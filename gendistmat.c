@@ -0,0 +1,80 @@
+// 町のファイル (gencity の出力) から距離行列ファイル (distmat.h の形式) を作る
+// 値の型は float か int (整数に丸めた EUC_2D)
+// 非対称の割合 (%) を渡すと、町 i から町 j への距離に 1 + (0以上その割合未満の乱数) を掛ける (向きごとに別の値)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "city.h"
+#include "distmat.h"
+#include "rng.h"
+
+int load_int(const char *argvalue)
+{
+  char *e;
+  errno = 0;
+  const long nl = strtol(argvalue, &e, 10);
+  if (errno == ERANGE || *e != '\0' || nl < 0) {
+    fprintf(stderr, "%s: invalid number.\n", argvalue);
+    exit(1);
+  }
+  return (int)nl;
+}
+
+int main(int argc, char **argv)
+{
+  if ((argc != 4 && argc != 6) || (strcmp(argv[3], "float") != 0 && strcmp(argv[3], "int") != 0)) {
+    fprintf(stderr, "usage: %s <city file> <outputfilename> float|int [<asymmetry %%> <random seed>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const int is_int = (strcmp(argv[3], "int") == 0);
+  const int asym = (argc == 6) ? load_int(argv[4]) : 0;
+  Rng rng;
+  rng_init(&rng, (argc == 6) ? load_int(argv[5]) : 1);
+
+  FILE *fp;
+  if ((fp = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "%s: cannot open file.\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  int n;
+  if (fread(&n, sizeof(int), 1, fp) != 1 || n <= 0) {
+    fprintf(stderr, "%s: invalid file.\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  City *city = (City*)malloc(sizeof(City) * n);
+  for (int i = 0; i < n; i++) {
+    if (fread(&city[i].x, sizeof(int), 1, fp) != 1 || fread(&city[i].y, sizeof(int), 1, fp) != 1) {
+      fprintf(stderr, "%s: invalid file.\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  }
+  fclose(fp);
+
+  if ((fp = fopen(argv[2], "wb")) == NULL) {
+    fprintf(stderr, "%s: cannot open file.\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  DistFileHeader h = { .n = n, .type = is_int ? DM_FILE_I32 : DM_FILE_F32 };
+  memcpy(h.magic, DM_FILE_MAGIC, 8);
+  fwrite(&h, sizeof(h), 1, fp);
+  // 1行ずつ書く (n * n の表をメモリに持たない)
+  float *row_f = (float*)malloc(sizeof(float) * n);
+  int32_t *row_i = (int32_t*)malloc(sizeof(int32_t) * n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      double d = distance(city[i], city[j]);
+      if (asym > 0 && i != j) d *= 1 + asym / 100.0 * rng_unit(&rng);
+      row_f[j] = (float)d;
+      row_i[j] = (int32_t)(d + 0.5);
+    }
+    if (is_int) fwrite(row_i, sizeof(int32_t), n, fp);
+    else fwrite(row_f, sizeof(float), n, fp);
+  }
+  fclose(fp);
+  free(row_f);
+  free(row_i);
+  free(city);
+  return EXIT_SUCCESS;
+}
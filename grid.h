@@ -0,0 +1,170 @@
+#ifndef GRID_H
+#define GRID_H
+
+// 町の座標に対する一様グリッドの空間索引
+// 1セルあたり数個の町が入るようにセルの大きさを決め、近い町を周囲のセルから順に探す
+//
+// grid_knn:      町 c に近い k 個の町 (近傍リスト用)
+// grid_nearest:  まだ取り除かれていない町のうち c に最も近い町 (最近傍法の初期解用)
+// grid_remove:   町を索引から取り除く
+
+#include <stdlib.h>
+#include <string.h>
+#include "city.h"
+
+typedef struct
+{
+  const City *city;
+  int nx, ny;     // セルの数
+  int minx, miny;
+  int cell;       // セルの一辺の長さ
+  int *start;     // セル i の町は items[start[i] .. start[i] + live[i])
+  int *live;      // セル i に残っている町の数
+  int *items;
+  int *where;     // where[c]: 町 c の items 内の位置 (索引にない町は -1)
+  int *cell_of;   // cell_of[c]: 町 c のセル番号
+} Grid;
+
+static inline int grid_cell_x(const Grid *g, int x)
+{
+  int cx = (x - g->minx) / g->cell;
+  return (cx < 0) ? 0 : (cx >= g->nx) ? g->nx - 1 : cx;
+}
+
+static inline int grid_cell_y(const Grid *g, int y)
+{
+  int cy = (y - g->miny) / g->cell;
+  return (cy < 0) ? 0 : (cy >= g->ny) ? g->ny - 1 : cy;
+}
+
+// ids[0..m) の町で索引を作る (ids == NULL なら 0..m-1 のすべての町)
+// n は町の番号の上限 (where, cell_of の大きさ)
+static Grid grid_build(const City *city, int n, const int *ids, int m)
+{
+  Grid g = { .city = city };
+  int maxx = 0, maxy = 0;
+  for (int k = 0; k < m; k++) {
+    const City c = city[ids ? ids[k] : k];
+    if (k == 0 || c.x < g.minx) g.minx = c.x;
+    if (k == 0 || c.y < g.miny) g.miny = c.y;
+    if (k == 0 || c.x > maxx) maxx = c.x;
+    if (k == 0 || c.y > maxy) maxy = c.y;
+  }
+  const double w = (double)maxx - g.minx + 1;
+  const double h = (double)maxy - g.miny + 1;
+  // 1セルあたり平均2個程度
+  int cell = (int)sqrt(w * h * 2.0 / (m > 0 ? m : 1));
+  g.cell = (cell < 1) ? 1 : cell;
+  g.nx = (int)(w / g.cell) + 1;
+  g.ny = (int)(h / g.cell) + 1;
+
+  const int cells = g.nx * g.ny;
+  g.start = (int*)calloc(cells + 1, sizeof(int));
+  g.live = (int*)calloc(cells, sizeof(int));
+  g.items = (int*)malloc(sizeof(int) * (m > 0 ? m : 1));
+  g.where = (int*)malloc(sizeof(int) * n);
+  g.cell_of = (int*)malloc(sizeof(int) * n);
+  for (int c = 0; c < n; c++) g.where[c] = -1;
+
+  for (int k = 0; k < m; k++) {
+    const int c = ids ? ids[k] : k;
+    g.cell_of[c] = grid_cell_y(&g, city[c].y) * g.nx + grid_cell_x(&g, city[c].x);
+    g.live[g.cell_of[c]]++;
+  }
+  for (int i = 0; i < cells; i++) g.start[i+1] = g.start[i] + g.live[i];
+  memset(g.live, 0, sizeof(int) * cells);
+  for (int k = 0; k < m; k++) {
+    const int c = ids ? ids[k] : k;
+    const int i = g.cell_of[c];
+    g.where[c] = g.start[i] + g.live[i]++;
+    g.items[g.where[c]] = c;
+  }
+  return g;
+}
+
+static void grid_free(Grid *g)
+{
+  free(g->start);
+  free(g->live);
+  free(g->items);
+  free(g->where);
+  free(g->cell_of);
+}
+
+static void grid_remove(Grid *g, int c)
+{
+  const int w = g->where[c];
+  if (w < 0) return;
+  const int i = g->cell_of[c];
+  const int last = g->start[i] + --g->live[i];
+  const int o = g->items[last];
+  g->items[w] = o;
+  g->where[o] = w;
+  g->items[last] = c;
+  g->where[c] = -1;
+}
+
+// grid_remove で取り除いた町をすべて戻す (確保し直さない)
+static void grid_reset(Grid *g)
+{
+  const int cells = g->nx * g->ny;
+  for (int i = 0; i < cells; i++) {
+    g->live[i] = g->start[i+1] - g->start[i];
+    for (int s = g->start[i]; s < g->start[i+1]; s++) g->where[g->items[s]] = s;
+  }
+}
+
+static inline double grid_dist2(const City a, const City b)
+{
+  const double dx = a.x - b.x;
+  const double dy = a.y - b.y;
+  return dx * dx + dy * dy;
+}
+
+// 町 c に近い順に最大 k 個を out に入れ、見つかった数を返す (c 自身は除く)
+// セル c の周り r 周目を調べ終えたとき、r+1 周目の町は少なくとも r * cell 離れている
+static int grid_knn(const Grid *g, int c, int k, int *out, double *d2)
+{
+  const City p = g->city[c];
+  const int cx = grid_cell_x(g, p.x);
+  const int cy = grid_cell_y(g, p.y);
+  const int max_r = (g->nx > g->ny) ? g->nx : g->ny;
+  int cnt = 0;
+  for (int r = 0; r <= max_r; r++) {
+    for (int y = cy - r; y <= cy + r; y++) {
+      if (y < 0 || y >= g->ny) continue;
+      const int step = (y == cy - r || y == cy + r) ? 1 : 2 * r; // 周上のセルだけ
+      for (int x = cx - r; x <= cx + r; x += (step > 0) ? step : 1) {
+        if (x < 0 || x >= g->nx) continue;
+        const int i = y * g->nx + x;
+        for (int s = g->start[i]; s < g->start[i] + g->live[i]; s++) {
+          const int o = g->items[s];
+          if (o == c) continue;
+          const double d = grid_dist2(p, g->city[o]);
+          if (cnt == k && d >= d2[k-1]) continue;
+          int j = (cnt < k) ? cnt++ : k - 1;
+          while (j > 0 && d2[j-1] > d) {
+            d2[j] = d2[j-1];
+            out[j] = out[j-1];
+            j--;
+          }
+          d2[j] = d;
+          out[j] = o;
+        }
+      }
+    }
+    const double reach = (double)r * g->cell;
+    if (cnt == k && d2[k-1] <= reach * reach) break;
+  }
+  return cnt;
+}
+
+// 索引に残っている町のうち c に最も近い町 (なければ -1)
+static int grid_nearest(const Grid *g, int c)
+{
+  int best;
+  double d2;
+  return (grid_knn(g, c, 1, &best, &d2) == 1) ? best : -1;
+}
+
+#endif
@@ -0,0 +1,1169 @@
+#ifndef HELDKARP_H
+#define HELDKARP_H
+
+// Held-Karp (bit DP) の表をコンパクトに持つ
+// 町0から出発するので、訪れた町の集合は必ず町0を含む。町1..n-1 の部分集合 mask (2^(n-1) 通り) だけを添字にする
+// 町 v (1..n-1) は v-1 ビット目, 表の1行は m = n-1 要素
+//
+// cost[mask * m + (v-1)]: mask の町を訪れて町vにいるとき、残りの町をすべて回って町0に戻る最短距離
+// parent[mask * m + (v-1)]: そのとき次に訪れる町 (n <= 256 なので uint8_t)
+// first: 町0の次に訪れる町
+//
+// 距離の型は3通り (HK_F64 の半分のメモリで済むのが HK_F32 と HK_U32)
+// HK_F64: double
+// HK_F32: float (巡回路が長いと下の桁が落ちる)
+// HK_U32: 固定小数点の uint32_t。巡回路の長さが 2^31 を超えないように倍率 scale を決める
+//         距離が整数で収まるなら scale = 1 (整数の距離の正確な表になる)
+//
+// いちばん時間のかかる計算は min_u (d(v,u) + cost[mask | u][u]) の min-plus である
+// mask ごとに c[u] = cost[mask | u][u] (訪れた町は INF) を1度だけ集めておけば、
+// 各 v については距離表の v 行と c の、連続した配列どうしの min-plus になる
+// これを AVX2 / AVX-512 のカーネル (最小値と、最小になる番号のうち最小のもの) で計算する
+// どの命令を使うかは実行時に CPU を調べて決め (hk_detect_simd)、使えなければスカラーで計算する
+// どのカーネルも同じ足し算をして番号の小さい方を選ぶので、表は命令によらず同じになる
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HK_X86 1
+#endif
+#include "distmat.h"
+#include "bitmask.h"
+
+typedef enum
+{
+  HK_F64,
+  HK_F32,
+  HK_U32,
+} HKCost;
+
+typedef enum
+{
+  HK_SCALAR,
+  HK_AVX2,
+  HK_AVX512,
+} HKSimd;
+
+#define HK_U32_INF 0xc0000000u // INF に距離を足しても桁あふれしない (巡回路は 2^31 未満)
+
+typedef struct
+{
+  int n;
+  int m;            // n - 1
+  HKCost kind;
+  HKSimd simd;      // 使うカーネル (hk_init が CPU を調べて決める。呼び出し側で変えてもよい)
+  void *dist;       // n * n の距離表 (cost と同じ型)
+  void *row;        // row[v * stride + (u-1)] = d(v,u)。各行を64バイト境界にそろえ、stride まで 0 で埋める
+  size_t stride;    // m を16要素の倍数に切り上げたもの (AVX-512 の1回分の倍数)
+  void *cost;
+  uint8_t *parent;
+  int first;
+  double scale;     // HK_U32 のときの倍率 (距離 * scale を丸めて持つ)
+} HeldKarp;
+
+static const int hk_max_n = 32; // mask を uint32_t で持つため
+
+static inline size_t hk_cost_size(HKCost kind)
+{
+  return (kind == HK_F64) ? sizeof(double) : 4;
+}
+
+static inline size_t hk_stride(int n)
+{
+  return (size_t)(n - 1 + 15) / 16 * 16;
+}
+
+// この CPU で使えるいちばん広い命令
+static inline HKSimd hk_detect_simd(void)
+{
+#ifdef HK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return HK_AVX512;
+  if (__builtin_cpu_supports("avx2")) return HK_AVX2;
+#endif
+  return HK_SCALAR;
+}
+
+// 表に必要なバイト数 (n が大きすぎて数えられなければ SIZE_MAX)
+static inline size_t hk_bytes(int n, HKCost kind)
+{
+  if (n < 2 || n > hk_max_n) return SIZE_MAX;
+  const size_t m = n - 1;
+  const size_t per_state = hk_cost_size(kind) + sizeof(uint8_t);
+  return ((size_t)1 << m) * m * per_state + ((size_t)n * n + n * hk_stride(n)) * hk_cost_size(kind);
+}
+
+static inline void hk_free(HeldKarp *hk)
+{
+  free(hk->dist);
+  free(hk->row);
+  free(hk->cost);
+  free(hk->parent);
+  hk->dist = hk->row = hk->cost = hk->parent = NULL;
+}
+
+// n 都市の距離表を確保する (値は hk_set_dist で入れる)。table が 1 なら表も確保する (0 は hk_solve_disk 用)
+// 確保できなければ -1
+static inline int hk_alloc(HeldKarp *hk, int n, HKCost kind, int table)
+{
+  *hk = (HeldKarp){ .n = n, .m = n - 1, .kind = kind, .simd = hk_detect_simd(), .stride = hk_stride(n),
+                    .first = 0, .scale = 1 };
+  const size_t es = hk_cost_size(kind);
+  hk->dist = malloc((size_t)n * n * es);
+  if (posix_memalign(&hk->row, 64, n * hk->stride * es) != 0) hk->row = NULL;
+  if (table) {
+    const size_t states = ((size_t)1 << hk->m) * hk->m;
+    hk->cost = malloc(states * es);
+    hk->parent = (uint8_t*)malloc(states);
+  }
+  if (hk->dist == NULL || hk->row == NULL || (table && (hk->cost == NULL || hk->parent == NULL))) {
+    hk_free(hk);
+    return -1;
+  }
+  return 0;
+}
+
+// d[i * n + j] (町iから町jへの距離) を kind の型に写す。d は対称でなくてもよい
+// 同じ n なら、表を確保し直さずに何度でも入れ替えて解ける
+static inline void hk_set_dist(HeldKarp *hk, const double *d)
+{
+  const int n = hk->n;
+  const size_t es = hk_cost_size(hk->kind);
+  hk->first = 0;
+  hk->scale = 1;
+  if (hk->kind == HK_U32) {
+    double max_d = 0;
+    for (int i = 0; i < n * n; i++) {
+      if (max_d < d[i]) max_d = d[i];
+    }
+    // 丸めで1辺あたり 0.5 増えても、n 辺の和が 2^31 を超えない倍率
+    hk->scale = (max_d > 0) ? ((double)(1u << 31) / n - 1) / max_d : 1;
+    // 距離がすべて整数 (DM_EUC2D など) で倍率を1にできるなら、丸めのない正確な整数の表にする
+    int integral = (hk->scale >= 1);
+    for (int i = 0; integral && i < n * n; i++) integral = (d[i] == floor(d[i]));
+    if (integral) hk->scale = 1;
+  }
+  for (int i = 0; i < n * n; i++) {
+    if (hk->kind == HK_F64) ((double*)hk->dist)[i] = d[i];
+    else if (hk->kind == HK_F32) ((float*)hk->dist)[i] = (float)d[i];
+    else ((uint32_t*)hk->dist)[i] = (uint32_t)llround(d[i] * hk->scale);
+  }
+  memset(hk->row, 0, n * hk->stride * es);
+  for (int v = 0; v < n; v++) {
+    memcpy((char*)hk->row + (v * hk->stride) * es, (char*)hk->dist + (v * n + 1) * es, hk->m * es);
+  }
+}
+
+static inline int hk_init_from(HeldKarp *hk, const DistMatrix *dm, int n, HKCost kind, int table)
+{
+  if (hk_alloc(hk, n, kind, table) != 0) return -1;
+  double *d = (double*)malloc(sizeof(double) * n * n);
+  if (d == NULL) {
+    hk_free(hk);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) d[i * n + j] = dm_get(dm, i, j);
+  }
+  hk_set_dist(hk, d);
+  free(d);
+  return 0;
+}
+
+// 距離表だけを kind の型に写す (表は確保しない。hk_solve_disk 用)。確保できなければ -1
+static inline int hk_init_dist(HeldKarp *hk, const DistMatrix *dm, int n, HKCost kind)
+{
+  return hk_init_from(hk, dm, n, kind, 0);
+}
+
+// 表を確保し、距離表を kind の型に写す。確保できなければ -1
+static inline int hk_init(HeldKarp *hk, const DistMatrix *dm, int n, HKCost kind)
+{
+  return hk_init_from(hk, dm, n, kind, 1);
+}
+
+// min-plus のカーネル: min_i (a[i] + b[i]) を返し、最小になる i のうち最小のものを arg に入れる
+// len は16の倍数, a と b は64バイト境界にそろっている
+// SIMD 版は、まず和の最小値を求め、次に和がそれと等しい最初の番号を探す (同じ足し算なので必ず見つかる)
+#define HK_DEFINE_SCALAR(SUFFIX, T, T_INF)                                         \
+  static inline T hk_minplus_##SUFFIX(const T *a, const T *b, int len, int *arg)   \
+  {                                                                                \
+    T ret = T_INF;                                                                 \
+    int best = 0;                                                                  \
+    for (int i = 0; i < len; i++) {                                                \
+      const T now = a[i] + b[i];                                                   \
+      best = (now < ret) ? i : best;                                               \
+      ret = (now < ret) ? now : ret;                                               \
+    }                                                                              \
+    *arg = best;                                                                   \
+    return ret;                                                                    \
+  }
+
+HK_DEFINE_SCALAR(f64, double, HUGE_VAL)
+HK_DEFINE_SCALAR(f32, float, HUGE_VALF)
+HK_DEFINE_SCALAR(u32, uint32_t, HK_U32_INF)
+
+#ifdef HK_X86
+__attribute__((target("avx2")))
+static inline double hk_minplus_f64_avx2(const double *a, const double *b, int len, int *arg)
+{
+  __m256d mn = _mm256_set1_pd(HUGE_VAL);
+  for (int i = 0; i < len; i += 4) mn = _mm256_min_pd(mn, _mm256_add_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+  __m128d x = _mm_min_pd(_mm256_castpd256_pd128(mn), _mm256_extractf128_pd(mn, 1));
+  x = _mm_min_sd(x, _mm_unpackhi_pd(x, x));
+  const double ret = _mm_cvtsd_f64(x);
+  const __m256d key = _mm256_set1_pd(ret);
+  for (int i = 0; ; i += 4) {
+    const int bits = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_add_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)), key, _CMP_EQ_OQ));
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static inline float hk_minplus_f32_avx2(const float *a, const float *b, int len, int *arg)
+{
+  __m256 mn = _mm256_set1_ps(HUGE_VALF);
+  for (int i = 0; i < len; i += 8) mn = _mm256_min_ps(mn, _mm256_add_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i)));
+  __m128 x = _mm_min_ps(_mm256_castps256_ps128(mn), _mm256_extractf128_ps(mn, 1));
+  x = _mm_min_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_min_ss(x, _mm_shuffle_ps(x, x, 1));
+  const float ret = _mm_cvtss_f32(x);
+  const __m256 key = _mm256_set1_ps(ret);
+  for (int i = 0; ; i += 8) {
+    const int bits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i)), key, _CMP_EQ_OQ));
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t hk_minplus_u32_avx2(const uint32_t *a, const uint32_t *b, int len, int *arg)
+{
+  __m256i mn = _mm256_set1_epi32((int)HK_U32_INF);
+  for (int i = 0; i < len; i += 8) {
+    const __m256i s = _mm256_add_epi32(_mm256_load_si256((const __m256i*)(a + i)), _mm256_load_si256((const __m256i*)(b + i)));
+    mn = _mm256_min_epu32(mn, s);
+  }
+  __m128i x = _mm_min_epu32(_mm256_castsi256_si128(mn), _mm256_extracti128_si256(mn, 1));
+  x = _mm_min_epu32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+  x = _mm_min_epu32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+  const uint32_t ret = (uint32_t)_mm_cvtsi128_si32(x);
+  const __m256i key = _mm256_set1_epi32((int)ret);
+  for (int i = 0; ; i += 8) {
+    const __m256i s = _mm256_add_epi32(_mm256_load_si256((const __m256i*)(a + i)), _mm256_load_si256((const __m256i*)(b + i)));
+    const int bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(s, key)));
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline double hk_minplus_f64_avx512(const double *a, const double *b, int len, int *arg)
+{
+  __m512d mn = _mm512_set1_pd(HUGE_VAL);
+  for (int i = 0; i < len; i += 8) mn = _mm512_min_pd(mn, _mm512_add_pd(_mm512_load_pd(a + i), _mm512_load_pd(b + i)));
+  const double ret = _mm512_reduce_min_pd(mn);
+  const __m512d key = _mm512_set1_pd(ret);
+  for (int i = 0; ; i += 8) {
+    const __mmask8 bits = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_load_pd(a + i), _mm512_load_pd(b + i)), key, _CMP_EQ_OQ);
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline float hk_minplus_f32_avx512(const float *a, const float *b, int len, int *arg)
+{
+  __m512 mn = _mm512_set1_ps(HUGE_VALF);
+  for (int i = 0; i < len; i += 16) mn = _mm512_min_ps(mn, _mm512_add_ps(_mm512_load_ps(a + i), _mm512_load_ps(b + i)));
+  const float ret = _mm512_reduce_min_ps(mn);
+  const __m512 key = _mm512_set1_ps(ret);
+  for (int i = 0; ; i += 16) {
+    const __mmask16 bits = _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_load_ps(a + i), _mm512_load_ps(b + i)), key, _CMP_EQ_OQ);
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline uint32_t hk_minplus_u32_avx512(const uint32_t *a, const uint32_t *b, int len, int *arg)
+{
+  __m512i mn = _mm512_set1_epi32((int)HK_U32_INF);
+  for (int i = 0; i < len; i += 16) mn = _mm512_min_epu32(mn, _mm512_add_epi32(_mm512_load_si512(a + i), _mm512_load_si512(b + i)));
+  const uint32_t ret = _mm512_reduce_min_epu32(mn);
+  const __m512i key = _mm512_set1_epi32((int)ret);
+  for (int i = 0; ; i += 16) {
+    const __mmask16 bits = _mm512_cmpeq_epi32_mask(_mm512_add_epi32(_mm512_load_si512(a + i), _mm512_load_si512(b + i)), key);
+    if (bits != 0) {
+      *arg = i + __builtin_ctz(bits);
+      return ret;
+    }
+  }
+}
+#endif
+
+// 型とカーネルごとの表の計算 (hk_fill_f64 など)
+// hk_fill_*: mask の各町 v の値を、mask に町を1つ足した集合の値から決める
+// buf は stride 要素の作業領域 (64バイト境界, m 以降は INF で埋めておく)
+// hk_last_*: 全部の町を訪れた集合 (町0に戻るだけ), hk_first_*: 町0から出発する
+#define HK_DEFINE_FILL(NAME, T, T_INF, KERNEL, ATTR)                               \
+  ATTR static void NAME(HeldKarp *hk, uint32_t mask, void *buf)                    \
+  {                                                                                \
+    const int m = hk->m;                                                           \
+    const size_t stride = hk->stride;                                              \
+    const T *row = (const T*)hk->row;                                              \
+    T *cost = (T*)hk->cost;                                                        \
+    T *c = (T*)buf;                                                                \
+    for (uint32_t rest = mask; rest != 0; rest = bm_drop_lowest(rest)) c[bm_lowest(rest)] = T_INF; \
+    for (uint32_t rest = ~mask & (((uint32_t)1 << m) - 1); rest != 0; rest = bm_drop_lowest(rest)) { \
+      const int u = bm_lowest(rest);                                               \
+      c[u] = cost[(size_t)(mask | (uint32_t)1 << u) * m + u];                      \
+    }                                                                              \
+    for (uint32_t rest = mask; rest != 0; rest = bm_drop_lowest(rest)) {           \
+      const int v = bm_lowest(rest);                                               \
+      int arg;                                                                     \
+      cost[(size_t)mask * m + v] = KERNEL(row + (v + 1) * stride, c, (int)stride, &arg); \
+      hk->parent[(size_t)mask * m + v] = (uint8_t)(arg + 1);                       \
+    }                                                                              \
+  }
+
+#define HK_DEFINE_ENDS(SUFFIX, T, T_INF)                                           \
+  static void hk_last_##SUFFIX(HeldKarp *hk)                                       \
+  {                                                                                \
+    const int n = hk->n, m = hk->m;                                                \
+    const uint32_t full = ((uint32_t)1 << m) - 1;                                  \
+    for (int v = 1; v < n; v++) {                                                  \
+      ((T*)hk->cost)[(size_t)full * m + v - 1] = ((const T*)hk->dist)[v * n];      \
+      hk->parent[(size_t)full * m + v - 1] = 0;                                    \
+    }                                                                              \
+  }                                                                                \
+  static void hk_first_##SUFFIX(HeldKarp *hk)                                      \
+  {                                                                                \
+    const T *dist = (const T*)hk->dist;                                            \
+    const T *cost = (const T*)hk->cost;                                            \
+    T ret = T_INF;                                                                 \
+    for (int u = 1; u < hk->n; u++) {                                              \
+      const T now = dist[u] + cost[((size_t)1 << (u-1)) * hk->m + u - 1];          \
+      if (now < ret) {                                                             \
+        ret = now;                                                                 \
+        hk->first = u;                                                             \
+      }                                                                            \
+    }                                                                              \
+  }
+
+HK_DEFINE_ENDS(f64, double, HUGE_VAL)
+HK_DEFINE_ENDS(f32, float, HUGE_VALF)
+HK_DEFINE_ENDS(u32, uint32_t, HK_U32_INF)
+
+typedef void (*HKFill)(HeldKarp *hk, uint32_t mask, void *buf);
+
+HK_DEFINE_FILL(hk_fill_f64, double, HUGE_VAL, hk_minplus_f64, )
+HK_DEFINE_FILL(hk_fill_f32, float, HUGE_VALF, hk_minplus_f32, )
+HK_DEFINE_FILL(hk_fill_u32, uint32_t, HK_U32_INF, hk_minplus_u32, )
+#ifdef HK_X86
+HK_DEFINE_FILL(hk_fill_f64_avx2, double, HUGE_VAL, hk_minplus_f64_avx2, __attribute__((target("avx2"))))
+HK_DEFINE_FILL(hk_fill_f32_avx2, float, HUGE_VALF, hk_minplus_f32_avx2, __attribute__((target("avx2"))))
+HK_DEFINE_FILL(hk_fill_u32_avx2, uint32_t, HK_U32_INF, hk_minplus_u32_avx2, __attribute__((target("avx2"))))
+HK_DEFINE_FILL(hk_fill_f64_avx512, double, HUGE_VAL, hk_minplus_f64_avx512, __attribute__((target("avx512f"))))
+HK_DEFINE_FILL(hk_fill_f32_avx512, float, HUGE_VALF, hk_minplus_f32_avx512, __attribute__((target("avx512f"))))
+HK_DEFINE_FILL(hk_fill_u32_avx512, uint32_t, HK_U32_INF, hk_minplus_u32_avx512, __attribute__((target("avx512f"))))
+#endif
+
+static inline HKFill hk_select_fill(const HeldKarp *hk)
+{
+#ifdef HK_X86
+  static const HKFill table[3][3] = {
+    { hk_fill_f64, hk_fill_f64_avx2, hk_fill_f64_avx512 },
+    { hk_fill_f32, hk_fill_f32_avx2, hk_fill_f32_avx512 },
+    { hk_fill_u32, hk_fill_u32_avx2, hk_fill_u32_avx512 },
+  };
+  return table[hk->kind][hk->simd];
+#else
+  static const HKFill table[3] = { hk_fill_f64, hk_fill_f32, hk_fill_u32 };
+  return table[hk->kind];
+#endif
+}
+
+// mask ごとの作業領域 (stride 要素, m 以降は INF)
+static inline void *hk_buf_new(const HeldKarp *hk)
+{
+  void *buf;
+  if (posix_memalign(&buf, 64, hk->stride * sizeof(double)) != 0) {
+    fprintf(stderr, "cannot allocate Held-Karp buffer.\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < hk->stride; i++) {
+    if (hk->kind == HK_F64) ((double*)buf)[i] = HUGE_VAL;
+    else if (hk->kind == HK_F32) ((float*)buf)[i] = HUGE_VALF;
+    else ((uint32_t*)buf)[i] = HK_U32_INF;
+  }
+  return buf;
+}
+
+// ---- 層のファイル ----
+// hk_solve_disk とチェックポイントは、町を k 個含む層ごとに次の町と値をファイルに置く (dir/hk_<parent|cost>_<k>.bin)
+// 層の中では集合を数の小さい順に並べ、集合ごとに k 個 (含む町の番号順) の枠を持つ
+// 集合の層内での番号は bm_rank, 同じ層の次の集合は bm_next_subset で求める (bitmask.h)
+
+// 層 k のファイルの大きさ (値, 次の町)
+static inline size_t hk_layer_states(int m, int k)
+{
+  bm_init();
+  return (size_t)bm_binom[m][k] * k;
+}
+
+static inline void hk_layer_path(char *path, size_t size, const char *dir, const char *name, int k)
+{
+  snprintf(path, size, "%s/hk_%s_%d.bin", dir, name, k);
+}
+
+// dir/hk_<name>_<k>.bin を bytes の大きさで作って mmap する。失敗したら NULL
+static inline void *hk_map_layer(const char *dir, const char *name, int k, size_t bytes, int create)
+{
+  char path[4096];
+  hk_layer_path(path, sizeof(path), dir, name, k);
+  const int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+  if (fd < 0 || (create && ftruncate(fd, (off_t)bytes) != 0)) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  void *p = mmap(NULL, bytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+  return p;
+}
+
+static inline void hk_unlink_layer(const char *dir, const char *name, int k)
+{
+  char path[4096];
+  hk_layer_path(path, sizeof(path), dir, name, k);
+  unlink(path);
+}
+
+// ---- チェックポイント (--checkpoint / --resume) ----
+// 層を埋め終えるたびに、埋め終えた層をディレクトリ dir に書き残し、途中で止められても続きから解けるようにする
+// 層 k..m が埋まっていれば、続きに必要なのは層 k..m の次の町と層 k の値だけである
+// dir には層のファイル (hk_solve_disk と同じ形) と、どの層まで書けたかを記録する hk_state.bin を置く
+// hk_solve_disk は dir に層のファイルを直接作るので、書くときは fsync するだけでよい
+//
+// 書き込みは別のスレッド (hk_ckpt_writer) がするので、表を埋めるスレッドは層を知らせるだけで待たない
+// 埋め終えた層はもう書き換わらないので、書き込みのスレッドはメモリの表からそのまま写す
+// 書き込みが追いつかなければ途中の層は飛ばし、書き終えたらそのときいちばん新しい層を書く
+// 新しい層のファイルを fsync してから hk_state.bin を rename で置き換え、そのあとで古い層の値のファイルを消す
+// 書いている途中で止められても、1つ前のチェックポイントはそのまま残る
+
+typedef struct
+{
+  char magic[8];      // "HKSTATE"
+  uint32_t version;   // hk_state_version
+  uint32_t n;
+  uint32_t kind;
+  uint32_t layer;     // 層 layer..m が書けている
+  double scale;
+  uint64_t dist_hash; // 距離表 (kind の型) のハッシュ。別のインスタンスの続きを解かないように比べる
+  uint64_t check;     // ここより前のハッシュ (書きかけのファイルを読まないように)
+} HKState;
+
+static const uint32_t hk_state_version = 1;
+
+typedef struct
+{
+  HeldKarp *hk;
+  const char *dir;
+  int disk;             // 1 なら層のファイルは hk_solve_disk が dir に作る
+  int start;            // 埋まっている層 (続きから解くとき。最初から解くなら m+1)
+  double every;         // 書く間隔 (秒)
+  uint64_t dist_hash;
+  pthread_t thread;
+  pthread_mutex_t lock; // 以下を守る
+  pthread_cond_t cond;
+  int posted;           // 埋め終えたいちばん新しい層 (m+1 ならまだない)
+  int writing;          // 書いている層 (0 ならなし)
+  int saved;            // 書けている層 (m+1 ならまだない)
+  int stop;
+  int failed;           // 書けなかったので、もう書かない
+  double last;          // 最後に書き始めた時刻
+} HKCheckpoint;
+
+static inline double hk_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// FNV-1a
+static inline uint64_t hk_hash(const void *p, size_t bytes)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < bytes; i++) h = (h ^ ((const uint8_t*)p)[i]) * 0x100000001b3ull;
+  return h;
+}
+
+static inline int hk_write_all(int fd, const void *p, size_t bytes)
+{
+  while (bytes > 0) {
+    const ssize_t w = write(fd, p, bytes);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    p = (const char*)p + w;
+    bytes -= w;
+  }
+  return 0;
+}
+
+static inline int hk_read_all(int fd, void *p, size_t bytes)
+{
+  while (bytes > 0) {
+    const ssize_t r = read(fd, p, bytes);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    p = (char*)p + r;
+    bytes -= r;
+  }
+  return 0;
+}
+
+static inline void hk_copy_slot(char *dst, const char *src, size_t es)
+{
+  if (es == 1) *dst = *src;
+  else if (es == 4) memcpy(dst, src, 4);
+  else memcpy(dst, src, 8);
+}
+
+// メモリの表の層 j の次の町 (cost が 0) または値 (cost が 1) を層のファイルに書く (load が 1 なら読んで表に戻す)
+// 失敗したら -1。書いている途中で stop が立ったら、そこでやめて -1
+static inline int hk_ckpt_copy(HKCheckpoint *ck, int cost, int j, int load)
+{
+  HeldKarp *hk = ck->hk;
+  const int m = hk->m;
+  const size_t es = cost ? hk_cost_size(hk->kind) : 1;
+  const size_t chunk = (size_t)1 << 20; // 1回に読み書きする枠の数
+  char path[4096];
+  hk_layer_path(path, sizeof(path), ck->dir, cost ? "cost" : "parent", j);
+  const int fd = load ? open(path, O_RDONLY) : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  char *table = cost ? (char*)hk->cost : (char*)hk->parent;
+  char *buf = (char*)malloc(chunk * es);
+  const size_t total = hk_layer_states(m, j);
+  uint32_t mask = ((uint32_t)1 << j) - 1; // 層 j の最初の集合
+  uint32_t rest = mask;                   // mask のうち、まだ写していない町
+  int status = (buf != NULL) ? 0 : -1;
+  for (size_t done = 0; done < total && status == 0; done += chunk) {
+    const size_t len = (total - done < chunk) ? total - done : chunk;
+    if (!load && __atomic_load_n(&ck->stop, __ATOMIC_RELAXED)) {
+      status = -1;
+      break;
+    }
+    if (load && hk_read_all(fd, buf, len * es) != 0) {
+      fprintf(stderr, "%s: cannot read\n", path);
+      status = -1;
+      break;
+    }
+    for (size_t i = 0; i < len; i++) {
+      const size_t at = ((size_t)mask * m + bm_lowest(rest)) * es;
+      if (load) hk_copy_slot(table + at, buf + i * es, es);
+      else hk_copy_slot(buf + i * es, table + at, es);
+      rest = bm_drop_lowest(rest);
+      if (rest == 0) rest = mask = bm_next_subset(mask);
+    }
+    if (!load && hk_write_all(fd, buf, len * es) != 0) {
+      perror(path);
+      status = -1;
+    }
+  }
+  if (status == 0 && !load && fdatasync(fd) != 0) {
+    perror(path);
+    status = -1;
+  }
+  close(fd);
+  free(buf);
+  return status;
+}
+
+// hk_solve_disk が作った層 j のファイルをディスクに書き出す
+static inline int hk_ckpt_sync(HKCheckpoint *ck, int cost, int j)
+{
+  char path[4096];
+  hk_layer_path(path, sizeof(path), ck->dir, cost ? "cost" : "parent", j);
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0 || fdatasync(fd) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static inline void hk_state_path(char *path, size_t size, const char *dir, const char *name)
+{
+  snprintf(path, size, "%s/hk_state.%s", dir, name);
+}
+
+// 層 k..m が書けたことを hk_state.bin に記録する
+static inline int hk_ckpt_commit(HKCheckpoint *ck, int k)
+{
+  const HeldKarp *hk = ck->hk;
+  HKState st;
+  memset(&st, 0, sizeof(st));
+  memcpy(st.magic, "HKSTATE", 8);
+  st.version = hk_state_version;
+  st.n = hk->n;
+  st.kind = hk->kind;
+  st.layer = k;
+  st.scale = hk->scale;
+  st.dist_hash = ck->dist_hash;
+  st.check = hk_hash(&st, offsetof(HKState, check));
+
+  char path[4096], tmp[4096];
+  hk_state_path(path, sizeof(path), ck->dir, "bin");
+  hk_state_path(tmp, sizeof(tmp), ck->dir, "tmp");
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int status = (fd >= 0 && hk_write_all(fd, &st, sizeof(st)) == 0 && fdatasync(fd) == 0) ? 0 : -1;
+  if (fd >= 0) close(fd);
+  if (status == 0 && rename(tmp, path) != 0) status = -1;
+  if (status != 0) {
+    perror(tmp);
+    return -1;
+  }
+  // rename もディスクに残す
+  const int dfd = open(ck->dir, O_RDONLY | O_DIRECTORY);
+  if (dfd >= 0) {
+    fsync(dfd);
+    close(dfd);
+  }
+  return 0;
+}
+
+// 層 k までのチェックポイントを書く (書けている層 saved より下の次の町と、層 k の値)
+static inline int hk_ckpt_write(HKCheckpoint *ck, int k, int saved)
+{
+  for (int j = saved - 1; j >= k; j--) {
+    if ((ck->disk ? hk_ckpt_sync(ck, 0, j) : hk_ckpt_copy(ck, 0, j, 0)) != 0) return -1;
+  }
+  if ((ck->disk ? hk_ckpt_sync(ck, 1, k) : hk_ckpt_copy(ck, 1, k, 0)) != 0) return -1;
+  if (hk_ckpt_commit(ck, k) != 0) return -1;
+  // 層 k より上の値はもう要らない
+  for (int j = k + 1; j <= ck->hk->m; j++) hk_unlink_layer(ck->dir, "cost", j);
+  return 0;
+}
+
+static inline void *hk_ckpt_writer(void *arg)
+{
+  HKCheckpoint *ck = (HKCheckpoint*)arg;
+  pthread_mutex_lock(&ck->lock);
+  while (!ck->stop) {
+    if (ck->failed || ck->posted >= ck->saved) {
+      pthread_cond_wait(&ck->cond, &ck->lock);
+      continue;
+    }
+    const double wake = ck->last + ck->every;
+    if (hk_now() < wake) {
+      const struct timespec ts = { .tv_sec = (time_t)wake, .tv_nsec = (long)((wake - (time_t)wake) * 1e9) };
+      pthread_cond_timedwait(&ck->cond, &ck->lock, &ts);
+      continue;
+    }
+    const int k = ck->posted, saved = ck->saved;
+    ck->writing = k;
+    ck->last = hk_now();
+    pthread_mutex_unlock(&ck->lock);
+    const int status = hk_ckpt_write(ck, k, saved);
+    pthread_mutex_lock(&ck->lock);
+    ck->writing = 0;
+    if (status == 0) ck->saved = k;
+    else if (!ck->stop) {
+      fprintf(stderr, "%s: cannot write the checkpoint, giving up checkpoints\n", ck->dir);
+      ck->failed = 1;
+    }
+  }
+  pthread_mutex_unlock(&ck->lock);
+  return NULL;
+}
+
+// dir にチェックポイントを書く準備をして、書き込みのスレッドを起動する (dir がなければ作る)
+// resume が 1 で、dir に同じインスタンスと距離の型のチェックポイントがあれば、その続きから解く
+// (メモリの表には読み戻す。なければ最初から解く)。every 秒より短い間隔では書かない
+// hk は hk_init (disk が 1 なら hk_init_dist) で作ったもの。失敗したら -1
+static inline int hk_ckpt_open(HKCheckpoint *ck, HeldKarp *hk, const char *dir, int resume, double every, int disk)
+{
+  bm_init();
+  const int m = hk->m;
+  *ck = (HKCheckpoint){ .hk = hk, .dir = dir, .disk = disk, .start = m + 1, .every = every,
+                        .dist_hash = hk_hash(hk->dist, (size_t)hk->n * hk->n * hk_cost_size(hk->kind)),
+                        .posted = m + 1, .writing = 0, .saved = m + 1, .stop = 0, .failed = 0, .last = -HUGE_VAL };
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    perror(dir);
+    return -1;
+  }
+  char path[4096];
+  hk_state_path(path, sizeof(path), dir, "bin");
+  const int fd = resume ? open(path, O_RDONLY) : -1;
+  if (resume && fd < 0) fprintf(stderr, "%s: no checkpoint, starting from the beginning\n", dir);
+  if (fd >= 0) {
+    HKState st;
+    const int ok = (hk_read_all(fd, &st, sizeof(st)) == 0);
+    close(fd);
+    if (!ok || memcmp(st.magic, "HKSTATE", 8) != 0 || st.check != hk_hash(&st, offsetof(HKState, check))) {
+      fprintf(stderr, "%s: broken checkpoint\n", path);
+      return -1;
+    }
+    if (st.version != hk_state_version) {
+      fprintf(stderr, "%s: unsupported checkpoint version %u\n", path, st.version);
+      return -1;
+    }
+    if (st.n != (uint32_t)hk->n || st.kind != (uint32_t)hk->kind || st.scale != hk->scale
+        || st.dist_hash != ck->dist_hash || st.layer < 1 || st.layer > (uint32_t)m) {
+      fprintf(stderr, "%s: checkpoint of another instance or cost type\n", path);
+      return -1;
+    }
+    ck->start = ck->posted = ck->saved = (int)st.layer;
+    if (!disk) {
+      for (int j = ck->start; j <= m; j++) {
+        if (hk_ckpt_copy(ck, 0, j, 1) != 0) return -1;
+      }
+      if (hk_ckpt_copy(ck, 1, ck->start, 1) != 0) return -1;
+    }
+    fprintf(stderr, "%s: resuming at layer %d of %d\n", dir, ck->start, m);
+  }
+  else {
+    // 前に解いたときのチェックポイントが残っていれば消す
+    unlink(path);
+    for (int k = 1; k < hk_max_n; k++) {
+      hk_unlink_layer(dir, "cost", k);
+      hk_unlink_layer(dir, "parent", k);
+    }
+  }
+
+  pthread_mutex_init(&ck->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&ck->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  const int err = pthread_create(&ck->thread, NULL, hk_ckpt_writer, ck);
+  if (err != 0) {
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    exit(1);
+  }
+  return 0;
+}
+
+// 層 k を埋め終えたことを知らせる (書き込みは待たない)
+static inline void hk_ckpt_post(HKCheckpoint *ck, int k)
+{
+  pthread_mutex_lock(&ck->lock);
+  ck->posted = k;
+  pthread_cond_signal(&ck->cond);
+  pthread_mutex_unlock(&ck->lock);
+}
+
+// hk_solve_disk が層 k の値を使い終えた。チェックポイントが使っていなければ消す
+static inline void hk_ckpt_release(HKCheckpoint *ck, int k)
+{
+  pthread_mutex_lock(&ck->lock);
+  if (k != ck->saved && k != ck->writing) hk_unlink_layer(ck->dir, "cost", k);
+  pthread_mutex_unlock(&ck->lock);
+}
+
+// 書き込みのスレッドを止める (書いている途中ならそこでやめる)
+// done が 1 なら解き終えたので、チェックポイントを消す (dir がほかに何もなければ dir も消す)
+static inline void hk_ckpt_close(HKCheckpoint *ck, int done)
+{
+  pthread_mutex_lock(&ck->lock);
+  __atomic_store_n(&ck->stop, 1, __ATOMIC_RELAXED);
+  pthread_cond_signal(&ck->cond);
+  pthread_mutex_unlock(&ck->lock);
+  pthread_join(ck->thread, NULL);
+  pthread_mutex_destroy(&ck->lock);
+  pthread_cond_destroy(&ck->cond);
+  if (done) {
+    char path[4096];
+    hk_state_path(path, sizeof(path), ck->dir, "bin");
+    unlink(path);
+    hk_state_path(path, sizeof(path), ck->dir, "tmp");
+    unlink(path);
+    for (int k = 1; k <= ck->hk->m; k++) {
+      hk_unlink_layer(ck->dir, "cost", k);
+      hk_unlink_layer(ck->dir, "parent", k);
+    }
+    rmdir(ck->dir);
+  }
+}
+
+// 複数スレッドで表を埋めるときのワーカー
+// 町を k 個含む集合の値は k+1 個の集合の値だけから決まるので、k の大きい層から1層ずつ埋め、層の間でそろえる
+// 1つの層の集合は番号順に hk_block 個ずつのブロックに分け、ブロックを順番にスレッドへ割り振る
+// ブロックの最初の集合を bm_unrank で求め、あとは bm_next_subset で層の集合だけをたどる
+// どの集合も同じ式で計算するので、スレッド数によらず同じ表になる
+// チェックポイントを書くときは、層をそろえるたびにワーカー0が知らせる
+typedef struct
+{
+  HeldKarp *hk;
+  HKFill fill;
+  int id;
+  int num_threads;
+  int top;          // 埋まっているいちばん下の層 (top-1 から埋める)
+  HKCheckpoint *ck; // NULL なら書かない
+  pthread_barrier_t *barrier;
+} HKWorker;
+
+static const uint32_t hk_block = 256;
+
+static inline void *hk_layer_worker(void *arg)
+{
+  HKWorker *w = (HKWorker*)arg;
+  const int m = w->hk->m;
+  void *buf = hk_buf_new(w->hk);
+  for (int k = w->top - 1; k >= 1; k--) {
+    const uint32_t num_masks = bm_binom[m][k];
+    for (uint32_t start = w->id * hk_block; start < num_masks; start += w->num_threads * hk_block) {
+      const uint32_t end = (num_masks - start < hk_block) ? num_masks : start + hk_block;
+      uint32_t mask = bm_unrank(start, k, m);
+      for (uint32_t r = start; r < end; r++, mask = bm_next_subset(mask)) w->fill(w->hk, mask, buf);
+    }
+    pthread_barrier_wait(w->barrier);
+    if (w->id == 0 && w->ck != NULL) hk_ckpt_post(w->ck, k);
+  }
+  free(buf);
+  return NULL;
+}
+
+// 表を埋めて first を決める (num_threads 本のスレッドを使う。1本なら mask の降順に埋める)
+// ck が NULL でなければ層ごとに埋めてチェックポイントを書き、続きから解くときは ck->start の1つ下の層から埋める
+static inline void hk_solve(HeldKarp *hk, int num_threads, HKCheckpoint *ck)
+{
+  bm_init();
+  const HKFill fill = hk_select_fill(hk);
+  int top = (ck != NULL) ? ck->start : hk->m + 1;
+  if (top > hk->m) {
+    if (hk->kind == HK_F64) hk_last_f64(hk);
+    else if (hk->kind == HK_F32) hk_last_f32(hk);
+    else hk_last_u32(hk);
+    top = hk->m;
+    if (ck != NULL) hk_ckpt_post(ck, top);
+  }
+
+  const uint32_t full = ((uint32_t)1 << hk->m) - 1;
+  if (num_threads > 1 && ((uint32_t)1 << hk->m) / hk_block < (uint32_t)num_threads) {
+    num_threads = (int)(((uint32_t)1 << hk->m) / hk_block); // ブロックより多いスレッドは使わない
+  }
+  if (num_threads < 1) num_threads = 1;
+  if (num_threads == 1 && ck == NULL) {
+    // mask の値は mask より大きい集合の値だけから決まるので、降順に埋めればよい
+    void *buf = hk_buf_new(hk);
+    for (uint32_t mask = full; mask-- > 1; ) fill(hk, mask, buf);
+    free(buf);
+  }
+  else {
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+    HKWorker *workers = (HKWorker*)malloc(sizeof(HKWorker) * num_threads);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    for (int t = 0; t < num_threads; t++) {
+      workers[t] = (HKWorker){ .hk = hk, .fill = fill, .id = t, .num_threads = num_threads, .top = top, .ck = ck,
+                               .barrier = &barrier };
+    }
+    // ワーカー0は呼び出し元のスレッドで動かす
+    for (int t = 1; t < num_threads; t++) {
+      const int err = pthread_create(&threads[t], NULL, hk_layer_worker, &workers[t]);
+      if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(1);
+      }
+    }
+    hk_layer_worker(&workers[0]);
+    for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+    pthread_barrier_destroy(&barrier);
+    free(workers);
+    free(threads);
+  }
+
+  if (hk->kind == HK_F64) hk_first_f64(hk);
+  else if (hk->kind == HK_F32) hk_first_f32(hk);
+  else hk_first_u32(hk);
+}
+
+// parent をたどって巡回順を route に入れる (route[0] = 0)
+static inline void hk_route(const HeldKarp *hk, int *route)
+{
+  route[0] = 0;
+  if (hk->n < 2) return;
+  int v = hk->first;
+  uint32_t mask = 0;
+  for (int i = 1; i < hk->n; i++) {
+    route[i] = v;
+    mask |= (uint32_t)1 << (v-1);
+    v = hk->parent[(size_t)mask * hk->m + v - 1];
+  }
+}
+
+// ---- ディスク上の表 (hk_solve_disk) ----
+// n が大きいと表がメモリに収まらない。町を k 個含む層は k+1 個の層しか読まないので、
+// 層ごとにファイルに分け、mmap して今計算している層と1つ上の層だけを使う
+// 値のファイルは1つ下の層を計算し終えたら消す。次の町のファイルは経路をたどり終えるまで残す
+
+// hk_solve_disk に必要なディスクの大きさ (次の町のファイル全部と、隣り合う live 層の値のファイル)
+// チェックポイントを書くときは、書けている層と書いている層の値も残るので live = 4
+static inline size_t hk_disk_bytes(int n, HKCost kind, int live)
+{
+  if (n < 2 || n > hk_max_n) return SIZE_MAX;
+  const int m = n - 1;
+  size_t parents = 0, costs = 0;
+  for (int k = 1; k <= m; k++) {
+    parents += hk_layer_states(m, k);
+    size_t sum = 0;
+    for (int j = k; j < k + live && j <= m; j++) sum += hk_layer_states(m, j) * hk_cost_size(kind);
+    if (costs < sum) costs = sum;
+  }
+  return parents + costs;
+}
+
+typedef void (*HKKernel)(void);
+
+static inline HKKernel hk_select_kernel(const HeldKarp *hk)
+{
+#ifdef HK_X86
+  static const HKKernel table[3][3] = {
+    { (HKKernel)hk_minplus_f64, (HKKernel)hk_minplus_f64_avx2, (HKKernel)hk_minplus_f64_avx512 },
+    { (HKKernel)hk_minplus_f32, (HKKernel)hk_minplus_f32_avx2, (HKKernel)hk_minplus_f32_avx512 },
+    { (HKKernel)hk_minplus_u32, (HKKernel)hk_minplus_u32_avx2, (HKKernel)hk_minplus_u32_avx512 },
+  };
+  return table[hk->kind][hk->simd];
+#else
+  static const HKKernel table[3] = { (HKKernel)hk_minplus_f64, (HKKernel)hk_minplus_f32, (HKKernel)hk_minplus_u32 };
+  return table[hk->kind];
+#endif
+}
+
+// 層 k の番号 [begin, end) の集合を計算するワーカー
+typedef struct
+{
+  const HeldKarp *hk;
+  HKKernel kernel;
+  int k;
+  const void *prev;   // 層 k+1 の値
+  void *cost;         // 層 k の値
+  uint8_t *parent;    // 層 k の次の町
+  uint32_t begin;
+  uint32_t end;
+} HKLayerWorker;
+
+#define HK_DEFINE_LAYER(SUFFIX, T, T_INF)                                          \
+  static void hk_disk_layer_##SUFFIX(HKLayerWorker *w, void *buf)                  \
+  {                                                                                \
+    const HeldKarp *hk = w->hk;                                                    \
+    const int m = hk->m, k = w->k;                                                 \
+    T (*kernel)(const T*, const T*, int, int*) = (T (*)(const T*, const T*, int, int*))w->kernel; \
+    const T *row = (const T*)hk->row;                                              \
+    const T *prev = (const T*)w->prev;                                             \
+    T *cost = (T*)w->cost;                                                         \
+    T *c = (T*)buf;                                                                \
+    uint32_t mask = bm_unrank(w->begin, k, m);                                     \
+    for (uint32_t r = w->begin; r < w->end; r++, mask = bm_next_subset(mask)) {    \
+      for (uint32_t rest = mask; rest != 0; rest = bm_drop_lowest(rest)) c[bm_lowest(rest)] = T_INF; \
+      for (uint32_t rest = ~mask & (((uint32_t)1 << m) - 1); rest != 0; rest = bm_drop_lowest(rest)) { \
+        const int u = bm_lowest(rest);                                             \
+        const uint32_t b = (uint32_t)1 << u;                                       \
+        c[u] = prev[(size_t)bm_rank(mask | b) * (k + 1) + __builtin_popcount(mask & (b - 1))]; \
+      }                                                                            \
+      int j = 0;                                                                   \
+      for (uint32_t rest = mask; rest != 0; rest = bm_drop_lowest(rest), j++) {    \
+        const int v = bm_lowest(rest);                                             \
+        int arg;                                                                   \
+        cost[(size_t)r * k + j] = kernel(row + (v + 1) * hk->stride, c, (int)hk->stride, &arg); \
+        w->parent[(size_t)r * k + j] = (uint8_t)(arg + 1);                         \
+      }                                                                            \
+    }                                                                              \
+  }
+
+HK_DEFINE_LAYER(f64, double, HUGE_VAL)
+HK_DEFINE_LAYER(f32, float, HUGE_VALF)
+HK_DEFINE_LAYER(u32, uint32_t, HK_U32_INF)
+
+static inline void *hk_disk_worker(void *arg)
+{
+  HKLayerWorker *w = (HKLayerWorker*)arg;
+  void *buf = hk_buf_new(w->hk);
+  if (w->hk->kind == HK_F64) hk_disk_layer_f64(w, buf);
+  else if (w->hk->kind == HK_F32) hk_disk_layer_f32(w, buf);
+  else hk_disk_layer_u32(w, buf);
+  free(buf);
+  return NULL;
+}
+
+// 表を dir の下に作る一時ディレクトリのファイルに置いて解き、巡回順を route に入れる (route[0] = 0)
+// hk は hk_init_dist で距離表だけを作ったもの。ファイルを作れなければ -1
+// 一時ディレクトリは解き終わったら (失敗しても) 消す。同じ dir で同時に複数解いてもよい
+// ck が NULL でなければ、層のファイルは一時ディレクトリではなく ck->dir に作ってチェックポイントにする
+// (dir は使わない。ファイルは hk_ckpt_close が消す)。続きから解くときは ck->start の1つ下の層から埋める
+static inline int hk_solve_disk(HeldKarp *hk, const char *dir, int num_threads, int *route, HKCheckpoint *ck)
+{
+  bm_init();
+  const int n = hk->n, m = hk->m;
+  const size_t es = hk_cost_size(hk->kind);
+  if (ck != NULL) dir = ck->dir;
+  const size_t need = hk_disk_bytes(n, hk->kind, (ck != NULL) ? 4 : 2);
+  struct statvfs vfs;
+  if (statvfs(dir, &vfs) == 0 && (size_t)vfs.f_bavail * vfs.f_frsize < need) {
+    fprintf(stderr, "%s: not enough space (%zu MB needed)\n", dir, need >> 20);
+    return -1;
+  }
+  char base[4000];
+  if (ck == NULL) {
+    snprintf(base, sizeof(base), "%s/hk.XXXXXX", dir);
+    if (mkdtemp(base) == NULL) {
+      perror(dir);
+      return -1;
+    }
+    dir = base;
+  }
+  int status = 0;
+
+  int top = (ck != NULL) ? ck->start : m + 1;
+  void *prev;
+  if (top <= m) {
+    // チェックポイントの続き: 層 top の値から始める
+    prev = hk_map_layer(dir, "cost", top, hk_layer_states(m, top) * es, 0);
+    if (prev == NULL) status = -1;
+  }
+  else {
+    // 全部の町を訪れた層 (集合は1つ) は町0に戻るだけ
+    top = m;
+    prev = hk_map_layer(dir, "cost", m, m * es, 1);
+    uint8_t *parent = (uint8_t*)hk_map_layer(dir, "parent", m, m, 1);
+    if (prev == NULL || parent == NULL) status = -1;
+    else {
+      for (int v = 1; v < n; v++) {
+        memcpy((char*)prev + (v - 1) * es, (const char*)hk->dist + (size_t)v * n * es, es);
+        parent[v - 1] = 0;
+      }
+    }
+    if (parent != NULL) munmap(parent, m);
+    if (status == 0 && ck != NULL) hk_ckpt_post(ck, m);
+  }
+
+  HKLayerWorker *workers = (HKLayerWorker*)malloc(sizeof(HKLayerWorker) * num_threads);
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  int k_prev = top; // prev の層
+  for (int k = top - 1; k >= 1 && status == 0; k--) {
+    const uint32_t num_masks = bm_binom[m][k];
+    const size_t states = hk_layer_states(m, k);
+    void *cost = hk_map_layer(dir, "cost", k, states * es, 1);
+    uint8_t *parent = (uint8_t*)hk_map_layer(dir, "parent", k, states, 1);
+    if (cost == NULL || parent == NULL) {
+      if (cost != NULL) munmap(cost, states * es);
+      if (parent != NULL) munmap(parent, states);
+      status = -1;
+      break;
+    }
+    // 層の集合を番号で num_threads 等分する (ワーカー0は呼び出し元のスレッドで動かす)
+    const int used = (num_masks < (uint32_t)num_threads) ? (int)num_masks : num_threads;
+    for (int t = 0; t < used; t++) {
+      workers[t] = (HKLayerWorker){ .hk = hk, .kernel = hk_select_kernel(hk), .k = k, .prev = prev,
+                                    .cost = cost, .parent = parent,
+                                    .begin = (uint32_t)((uint64_t)num_masks * t / used),
+                                    .end = (uint32_t)((uint64_t)num_masks * (t + 1) / used) };
+    }
+    for (int t = 1; t < used; t++) {
+      const int err = pthread_create(&threads[t], NULL, hk_disk_worker, &workers[t]);
+      if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(1);
+      }
+    }
+    hk_disk_worker(&workers[0]);
+    for (int t = 1; t < used; t++) pthread_join(threads[t], NULL);
+
+    munmap(prev, hk_layer_states(m, k + 1) * es);
+    munmap(parent, states);
+    if (ck != NULL) {
+      // チェックポイントが使っている値のファイルは、書き込みのスレッドが次を書き終えてから消す
+      hk_ckpt_post(ck, k);
+      hk_ckpt_release(ck, k + 1);
+    }
+    else hk_unlink_layer(dir, "cost", k + 1);
+    prev = cost;
+    k_prev = k;
+  }
+  free(workers);
+  free(threads);
+
+  if (status == 0) {
+    // 町0の次: 町 u だけを訪れた集合は層1の u-1 番目
+    double best = HUGE_VAL;
+    for (int u = 1; u < n; u++) {
+      double now;
+      if (hk->kind == HK_F64) now = ((const double*)hk->dist)[u] + ((const double*)prev)[u - 1];
+      else if (hk->kind == HK_F32) now = (double)(((const float*)hk->dist)[u] + ((const float*)prev)[u - 1]);
+      else now = (double)(((const uint32_t*)hk->dist)[u] + ((const uint32_t*)prev)[u - 1]);
+      if (now < best) {
+        best = now;
+        hk->first = u;
+      }
+    }
+
+    // 次の町のファイルをたどる
+    route[0] = 0;
+    int v = hk->first;
+    uint32_t mask = 0;
+    for (int i = 1; i < n && status == 0; i++) {
+      route[i] = v;
+      mask |= (uint32_t)1 << (v - 1);
+      if (i == n - 1) break;
+      const int k = i;
+      char path[4096];
+      hk_layer_path(path, sizeof(path), dir, "parent", k);
+      const int fd = open(path, O_RDONLY);
+      uint8_t next;
+      const off_t at = (off_t)bm_rank(mask) * k + __builtin_popcount(mask & (((uint32_t)1 << (v - 1)) - 1));
+      if (fd < 0 || pread(fd, &next, 1, at) != 1) {
+        perror(path);
+        status = -1;
+      }
+      if (fd >= 0) close(fd);
+      v = next;
+    }
+  }
+  if (prev != NULL) munmap(prev, hk_layer_states(m, k_prev) * es);
+  if (ck != NULL) return status;
+  for (int k = 1; k <= m; k++) {
+    hk_unlink_layer(dir, "cost", k);
+    hk_unlink_layer(dir, "parent", k);
+  }
+  rmdir(dir);
+  return status;
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <string.h> // strtol, strtod, strerror
 #include <errno.h> // strtol, strtod でerror を補足したい
+#include "rng.h"
 
 // 以下は構造体の定義と関数のプロトタイプ宣言
 
@@ -169,10 +170,11 @@ Itemset *init_itemset(int number, int seed)
 
   Item *item = (Item*)malloc(sizeof(Item)*number);
 
-  srand(seed);
+  Rng rng;
+  rng_init(&rng, seed);
   for (int i = 0 ; i < number ; i++){
-    item[i].value = 0.1 * (rand() % 200);
-    item[i].weight = 0.1 * (rand() % 200 + 1);
+    item[i].value = 0.1 * rng_below(&rng, 200);
+    item[i].weight = 0.1 * (rng_below(&rng, 200) + 1);
   }
   *list = (Itemset){.number = number, .item = item};
   return list;
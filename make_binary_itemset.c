@@ -1,23 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "rng.h"
 
 // 課題3のテスト用プログラム
 // アイテムセットのバイナリファイルを書き出す
-int main() {
+// 引数でシードを渡せる (省略すると 1)。同じシードなら同じファイルになる
+int main(int argc, char **argv) {
   char *filename = "binary_item.txt";
   FILE *fp = fopen(filename, "wb");
 
+  Rng rng;
+  rng_init(&rng, (argc > 1) ? strtoull(argv[1], NULL, 10) : 1);
+
   int n = 10;
   fwrite(&n, sizeof(int), 1, fp);
 
   double value, weight;
   for (int i = 0; i < n; i++) {
-    value = 0.1 * (rand() % 200);
+    value = 0.1 * rng_below(&rng, 200);
     fwrite(&value, sizeof(double), 1, fp);
   }
   for (int i = 0; i < n; i++) {
-    weight = 0.1 * (rand() % 200);
+    weight = 0.1 * rng_below(&rng, 200);
     fwrite(&weight, sizeof(double), 1, fp);
   }
   
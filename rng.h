@@ -0,0 +1,94 @@
+#ifndef RNG_H
+#define RNG_H
+
+// 乱数生成器 (xoshiro256**)
+// rand() はロックを取るうえ質が悪く、実装によって系列が変わるので使わない
+// 状態は呼び出し側が持つので、スレッドごとに別の状態を持てばロックなしで使える
+//
+// rng_init: 64ビットのシードから splitmix64 で状態を作る
+// rng_init_stream: シードと番号から状態を作る。番号ごとに別の系列になる (スレッドの割り当てによらず再現できる)
+// rng_jump: 2^128 回分進める。同じシードから jump した回数ごとに重ならない系列になる
+// rng_below: [0, bound) の一様な整数 (Lemire の方法。% による偏りがない)
+
+#include <stdint.h>
+
+typedef struct
+{
+  uint64_t s[4];
+} Rng;
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline void rng_init(Rng *r, uint64_t seed)
+{
+  for (int i = 0; i < 4; i++) r->s[i] = splitmix64(&seed);
+}
+
+static inline void rng_init_stream(Rng *r, uint64_t seed, uint64_t stream)
+{
+  rng_init(r, seed ^ splitmix64(&stream));
+}
+
+static inline uint64_t rng_rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(Rng *r)
+{
+  uint64_t *s = r->s;
+  const uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rng_rotl(s[3], 45);
+  return result;
+}
+
+static inline void rng_jump(Rng *r)
+{
+  static const uint64_t jump[4] = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull,
+                                    0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+  uint64_t s[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < 4; i++) {
+    for (int b = 0; b < 64; b++) {
+      if (jump[i] & ((uint64_t)1 << b)) {
+        for (int k = 0; k < 4; k++) s[k] ^= r->s[k];
+      }
+      rng_next(r);
+    }
+  }
+  for (int k = 0; k < 4; k++) r->s[k] = s[k];
+}
+
+// [0, bound) の一様な整数 (bound > 0)
+static inline uint32_t rng_below(Rng *r, uint32_t bound)
+{
+  uint64_t m = (uint64_t)(uint32_t)(rng_next(r) >> 32) * bound;
+  uint32_t low = (uint32_t)m;
+  if (low < bound) {
+    const uint32_t threshold = -bound % bound; // 2^32 を bound で割った余り
+    while (low < threshold) {
+      m = (uint64_t)(uint32_t)(rng_next(r) >> 32) * bound;
+      low = (uint32_t)m;
+    }
+  }
+  return (uint32_t)(m >> 32);
+}
+
+// [0, 1) の一様な実数 (53ビット)
+static inline double rng_unit(Rng *r)
+{
+  return (rng_next(r) >> 11) * 0x1.0p-53;
+}
+
+#endif
@@ -6,16 +6,18 @@
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
 #include <time.h>
+#include <pthread.h>
+#include "city.h"
+#include "distmat.h"
+#include "grid.h"
+#include "twolevel.h"
+#include "rng.h"
+#include "batch.h"
+#include "bitmask.h"
+#include "heldkarp.h"
 
 #define INF 1e9 // 最短距離の解の初期値
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
-
 // 描画用
 typedef struct
 {
@@ -29,6 +31,183 @@ typedef struct ans {
   int *route;
 } Answer;
 
+// 局所探索が使う巡回路の表現
+// TOUR_ARRAY:  route[i]: i番目に訪れる町, pos[c]: 町cを訪れる順番。反転は O(n)
+// TOUR_2LEVEL: 2-level doubly-linked list (twolevel.h)。反転は O(sqrt n)
+// どちらも tour_next / tour_prev / tour_between / two_opt_move で扱う
+enum { TOUR_ARRAY, TOUR_2LEVEL };
+
+typedef struct
+{
+  int n;
+  int kind;
+  int *route;
+  int *pos;
+  TwoLevel *tl;
+} Tour;
+
+// don't-look bit 付きの待ち行列 (active[c] == 0 の町は調べない)
+typedef struct
+{
+  int *buf;
+  char *active;
+  int head;
+  int count;
+  int n;
+} Queue;
+
+// ワーカーごとの作業領域
+// 初期解ごと・パスごとに確保し直さないように、ワーカーの開始時に1度だけ確保して使い回す
+typedef struct
+{
+  int n;
+  int *route;   // 探索中の巡回路
+  int *best;    // このワーカーの最良解
+  int *pos;     // pos[c]: route 内で町cを訪れる順番
+  int *buf;     // 回転などに使う作業用
+  Queue q;
+  int *lk_log;  // LK の移動の記録
+  int *lk_mark;
+  int lk_stamp;
+  Grid grid;    // 最近傍法の初期解用 (INIT_NN のときだけ作る)
+  TwoLevel tl;  // TOUR_2LEVEL のときだけ作る
+  int tour_kind;
+} Workspace;
+
+// 局所探索の種類
+// SEARCH_SWAP: 2都市の入れ替え (ハミング距離2の近傍)
+// SEARCH_2OPT: 近傍リストを使った 2-opt + Or-opt
+// SEARCH_LK:   Lin-Kernighan 風の可変深さ探索 (2-opt 移動の連鎖) + Or-opt
+enum { SEARCH_SWAP, SEARCH_2OPT, SEARCH_LK };
+
+// 初期解の作り方
+// INIT_RANDOM: ランダムな順列
+// INIT_NN:     ランダムな町から始める最近傍法
+// INIT_GREEDY: 短い辺から順につなぐ貪欲法 (決定的なので main で1度だけ作る)
+enum { INIT_RANDOM, INIT_NN, INIT_GREEDY };
+
+static int init_method = INIT_RANDOM;
+
+static int search_method = SEARCH_SWAP;
+static int num_neighbor = 10; // 近傍リストの長さ (--neighbors)
+static int lk_max_depth = 30; // LK の1回の探索で連鎖させる 2-opt 移動の最大数
+static int tour_kind = -1;    // -1: 町の数で選ぶ (tour_auto_threshold 以上なら 2-level)
+static const int tour_auto_threshold = 20000;
+
+static DistKind dist_kind = DM_FULL_F64;  // --dist (--metric euc2d では既定が DM_FULL_I32)
+static int dist_given = 0;
+static DistMetric metric = DM_EUCLID;     // --metric
+static size_t dist_mem_limit = (size_t)1 << 30; // これを超える表は作らず、その都度計算する
+
+// インスタンスごとに1度だけ作るもの (solve_instance が作って解放する)
+// --batch では別々のインスタンスを別々のスレッドで同時に解くので、スレッドごとに持つ
+// 1つのインスタンスを複数のスレッドで解くときは、ワーカーの開始時に呼び出し元の inst を写す
+typedef struct
+{
+  DistMatrix dm;      // 距離表
+  int num_neighbor;   // min(--neighbors, n-1)
+  int *neighbor;      // neighbor[c * num_neighbor + k]: 町cからk番目に近い町
+  int *greedy_route;  // 貪欲法の初期解 (決定的なので1度だけ作る)
+  double gap_target;  // --gap: この長さ以下の解が見つかったら探索をやめる (0 なら使わない)
+  int *stop_search;   // このインスタンスを解く全ワーカーで共有する停止フラグ
+  int asymmetric;     // 非対称な距離行列ファイル (2opt / lk, 下界, --exact は対称な距離を前提にするので使わない)
+  int integral;       // 距離がすべて整数 (--metric euc2d か int32 の距離行列ファイル)
+} Instance;
+
+static __thread Instance inst = { .dm = { .kind = DM_IMPLICIT } };
+
+static inline double dist(int a, int b)
+{
+  return dm_get(&inst.dm, a, b);
+}
+
+// 町 a から町 b への正確な距離。座標があれば座標から (--metric の測り方で)、距離行列ファイル (city = NULL) なら表から
+static inline double exact_dist(const City *city, int a, int b)
+{
+  return (city != NULL) ? dm_distance(metric, city[a], city[b]) : dist(a, b);
+}
+
+// 乱数の状態はスレッドごとに持つ (rng.h)
+// 初期解や子を作るたびに、その番号の系列に取り直すので、どのスレッドが解いても同じ結果になる
+static __thread Rng rng;
+
+// 探索の統計 (--stats)
+// 数えるのは各スレッドの TLS なので、探索中に共有の変数やロックには触らない
+// ワーカーの終わりに自分の分を写し、インスタンスを解き終わったら合計する
+// passes: swap では最良の入れ替えを探した回数、2opt/lk では待ち行列から取り出した町の数
+// moves_evaluated: 増分を計算した移動の数, improving_moves: 適用した改善移動の数
+// 焼きなましではスレッド1本を初期解1つと数え、試した入れ替えと受け入れた改善を数える
+typedef struct
+{
+  long restarts;         // 解いた初期解 (GA では子) の数
+  long passes;
+  long moves_evaluated;
+  long improving_moves;
+  double restart_sum;    // 初期解1つあたりの時間 (秒) の合計, 最小, 最大
+  double restart_min;
+  double restart_max;
+  double time_to_best;   // 探索を始めてから最終的な最良解が見つかるまで (秒)
+  double time_total;     // 探索にかかった時間 (秒)
+  long windows_solved;   // --window で解いた窓の数と、巡回路が短くなった窓の数
+  long windows_improved;
+  long exact_nodes;      // --exact で調べた分枝限定法の節の数と、最適性を示せたか
+  int exact_proved;
+} Stats;
+
+static __thread Stats stats;
+
+// 並列に初期解を回すワーカー
+typedef struct
+{
+  const City *city;
+  int n;
+  int id;
+  uint64_t seed;
+  long *next_restart; // 全ワーカーで共有する、次に試す初期解の番号
+  long num_restarts;
+  double deadline;    // 0 でなければ、この時刻 (now_sec) まで焼きなましを続ける
+  Workspace *ws;
+  Answer best;        // このワーカーが見つけた最良解 (route は ws->best を指す)
+  long best_restart;  // best を見つけた初期解の番号 (同じ長さなら番号の小さい方を残す)
+  double best_time;   // best を見つけた時刻 (now_sec)
+  Stats stats;        // このワーカーの統計
+  const Instance *inst;
+} Worker;
+
+static double time_limit = 0; // --time-limit (秒)。0 なら初期解の数で止める
+static int ga_pop = 0;          // --ga (集団の大きさ)。0 なら遺伝的アルゴリズムは使わない
+static const int bound_max_n = 1000; // Held-Karp の下界を計算する町の数の上限 (1反復 O(n^2))
+static int ga_generations = 50; // --generations
+static int window_size = 0;     // --window (0 なら使わない)
+static const int window_max = 20; // 窓の表は 2^K * K 要素なので大きくしすぎない
+static double exact_limit = -1;   // --exact (秒)。負なら使わない、0 なら時間制限なし
+static const int exact_max_n = 64; // 訪れた町の集合を uint64_t で持つ
+
+// 遺伝的アルゴリズムで全ワーカーが共有する状態
+// pool[0..pop) が親の世代、pool[pop..2*pop) がその世代に作る子
+typedef struct
+{
+  const City *city;
+  int n;
+  int pop;
+  Answer *pool;
+  Answer *tmp;        // 世代交代の作業領域 (2*pop)
+  long next_child;    // 次に作る子の番号
+  int done;
+  double best_dist;   // これまでの最良の長さと、それが見つかった世代交代の時刻 (now_sec)
+  double best_time;
+  pthread_barrier_t barrier;
+} GA;
+
+typedef struct
+{
+  GA *ga;
+  uint64_t seed;
+  Workspace *ws;
+  Stats stats;
+  const Instance *inst;
+} GAWorker;
+
 // 整数最大値をとる関数
 int max(const int a, const int b)
 {
@@ -54,14 +233,45 @@ void swap(int *a, int *b) {
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double total_distance(const City *city, int *route, int n);
+double total_distance(int *route, int n);
+double route_length(const City *city, const int *route, int n);
+double swap_delta(const int *route, int n, int i, int j);
 void gen_random_permutation(int *pattern, int n);
-Answer yamanobori(const City *city, int *route, int n);
-Answer solve(const City *city, int n);
+void rotate_route(int *route, int n, int *buf);
+void nearest_neighbor_tour(Grid *g, int n, int start, int *route);
+void nearest_neighbor_scan(int n, int start, int *route, int *buf);
+int *greedy_edge_tour(const City *city, int n);
+Answer yamanobori(int *route, int n, double cur_dist);
+int *build_neighbor_lists(const City *city, int n, int k);
+Answer two_opt_oropt(Workspace *ws);
+Answer lin_kernighan(Workspace *ws);
+Workspace *workspace_new(const City *city, int n);
+void workspace_free(Workspace *ws);
+void initial_route(const City *city, int n, Workspace *ws);
+Answer solve(const City *city, int n, Workspace *ws);
+Answer local_search(int n, Workspace *ws);
+double now_sec(void);
+Answer anneal(const City *city, int n, double deadline, Workspace *ws, double *found_at);
+void stats_restart(Stats *s, double elapsed);
+void stats_merge(Stats *to, const Stats *from);
+void write_stats(FILE *fp, const char *file, int n, int num_threads, double best, double lower_bound,
+                 const Stats *s);
+void *restart_worker(void *arg);
+Answer multi_start(const City *city, int n, long num_restarts, int num_threads, uint64_t seed, Stats *st);
+void order_crossover(const int *pa, const int *pb, int n, int *child, int *used);
+void *ga_worker(void *arg);
+Answer genetic(const City *city, int n, int num_threads, uint64_t seed, Stats *st);
+double held_karp_bound(int n, double *best_pi);
+void window_optimize(const City *city, int n, int *route, int num_threads, Stats *st);
+int exact_search(int n, int *route, const double *pi, int num_threads, Stats *st);
+Answer solve_instance(const City *city, const DistMatrix *matrix, int n, long num_restarts, int num_threads,
+                      uint64_t seed, double gap_pct, double *lower_bound, Stats *st);
+int run_batch(const char *path, long num_restarts, int num_threads, uint64_t seed, double gap_pct,
+              FILE *stats_fp);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
+City *load_cities(const char* filename,int *n); // 読めなければ NULL
+int load_instance(const char *filename, City **city, DistMatrix *matrix, int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -84,71 +294,271 @@ City *load_cities(const char *filename, int *n)
   FILE *fp;
   if ((fp = fopen(filename,"rb")) == NULL){
     fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
+    return NULL;
   }
-  fread(n,sizeof(int),1,fp);
+  // n はファイルの大きさと合っていなければ信用しない (壊れたファイルで巨大な malloc をしない)
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0 || fread(n,sizeof(int),1,fp) != 1 || *n <= 1 ||
+      (uint64_t)st.st_size != sizeof(int) + (uint64_t)*n * sizeof(City)) {
+    fprintf(stderr, "%s: invalid file.\n",filename);
+    fclose(fp);
+    return NULL;
+  }
+  // City は x, y の int 2つなので、ファイルの並びのまま一度に読める
   city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
+  if (city == NULL) {
+    fprintf(stderr, "%s: cannot allocate memory.\n",filename);
+    fclose(fp);
+    return NULL;
+  }
+  if (fread(city, sizeof(City), *n, fp) != (size_t)*n) {
+    fprintf(stderr, "%s: invalid file.\n",filename);
+    fclose(fp);
+    free(city);
+    return NULL;
   }
   fclose(fp);
   return city;
 }
 
+// filename が距離行列ファイル (distmat.h) なら matrix に mmap し (*city = NULL)、そうでなければ町の座標を読む
+// 読めなければ -1
+int load_instance(const char *filename, City **city, DistMatrix *matrix, int *n)
+{
+  *city = NULL;
+  *matrix = (DistMatrix){ .kind = DM_IMPLICIT };
+  if (dm_is_matrix_file(filename)) {
+    if (dm_load(filename, matrix) != 0) return -1;
+    *n = matrix->n;
+    return 0;
+  }
+  *city = load_cities(filename, n);
+  return (*city == NULL) ? -1 : 0;
+}
+
+long load_long(const char *argvalue)
+{
+  char *e;
+  errno = 0;
+  const long nl = strtol(argvalue, &e, 10);
+  if (errno == ERANGE) {
+    fprintf(stderr, "%s: %s\n", argvalue, strerror(errno));
+    exit(1);
+  }
+  if (*e != '\0') {
+    fprintf(stderr, "irregular character %s found in %s\n", e, argvalue);
+    exit(1);
+  }
+  return nl;
+}
+
+void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s <city file> [number of initial solutions] [options]\n", prog);
+  fprintf(stderr, "       %s --batch <list file|directory> [number of initial solutions] [options]\n", prog);
+  fprintf(stderr, "  --search swap|2opt|lk\n");
+  fprintf(stderr, "                       local search (default: swap)\n");
+  fprintf(stderr, "  --neighbors K        candidate list length for 2opt/lk (default: 10)\n");
+  fprintf(stderr, "  --lk-depth D         maximum number of moves in one lk chain (default: 30)\n");
+  fprintf(stderr, "  --tour array|2level  tour representation for 2opt/lk\n");
+  fprintf(stderr, "                       (default: 2level from 20000 cities)\n");
+  fprintf(stderr, "  --init random|nn|greedy\n");
+  fprintf(stderr, "                       initial tour (default: random)\n");
+  fprintf(stderr, "  --threads N          worker threads, 0 = all cores (default: 1)\n");
+  fprintf(stderr, "                       with --batch: number of instances solved at once\n");
+  fprintf(stderr, "  --seed S             random seed (default: current time)\n");
+  fprintf(stderr, "  --time-limit SEC     anneal on the swap neighborhood for SEC seconds\n");
+  fprintf(stderr, "                       instead of counting initial solutions\n");
+  fprintf(stderr, "  --ga POP             memetic search: evolve POP tours with order crossover,\n");
+  fprintf(stderr, "                       polishing each child with the local search\n");
+  fprintf(stderr, "  --generations G      number of generations for --ga (default: 50)\n");
+  fprintf(stderr, "  --gap PCT            stop once the best tour is within PCT%% of the\n");
+  fprintf(stderr, "                       Held-Karp lower bound (up to %d cities)\n", bound_max_n);
+  fprintf(stderr, "  --window K           polish the final tour by solving every K consecutive\n");
+  fprintf(stderr, "                       cities exactly (Held-Karp, K <= %d, 12-16 is typical)\n", window_max);
+  fprintf(stderr, "  --exact SEC          prove the final tour optimal (or improve it) by branch\n");
+  fprintf(stderr, "                       and bound, giving up after SEC seconds, 0 = no limit\n");
+  fprintf(stderr, "                       (up to %d cities, 20-40 is typical)\n", exact_max_n);
+  fprintf(stderr, "  --metric euclid|euc2d\n");
+  fprintf(stderr, "                       distances: exact Euclidean, or rounded to the nearest\n");
+  fprintf(stderr, "                       integer as in TSPLIB EUC_2D (default: euclid)\n");
+  fprintf(stderr, "  --dist full|float|tri|tri-float|int|tri-int|none\n");
+  fprintf(stderr, "                       distance matrix layout, int and tri-int need euc2d\n");
+  fprintf(stderr, "                       (default: full, int for euc2d)\n");
+  fprintf(stderr, "  --dist-mem MB        largest matrix to precompute (default: 1024)\n");
+  fprintf(stderr, "  --stats FILE         write search counters as JSON (one line per instance),\n");
+  fprintf(stderr, "                       - for standard output\n");
+  exit(1);
+}
+
 int main(int argc, char**argv)
 {
-  srand(time(NULL));
   long num_initial_solution = 100;
+  int num_threads = 1;
+  double gap_pct = -1; // --gap (%)。負なら使わない
+  uint64_t seed = (uint64_t)time(NULL);
+  int seed_given = 0;
+  const char *batch_path = NULL; // --batch
+  const char *stats_path = NULL; // --stats
   
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 100;
 
   Map map = init_map(width, height);
   
   FILE *fp = stdout; // とりあえず描画先は標準出力としておく
-  if (argc != 2 && argc != 3){
-    fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
-    exit(1);
-  }
-  int n;
 
-  City *city = load_cities(argv[1],&n);
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
+  // 位置引数: 都市ファイル, 初期解の数 / それ以外は --option value の形
+  const char *positional[2];
+  int num_positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      if (num_positional == 2) usage(argv[0]);
+      positional[num_positional++] = argv[i];
+      continue;
+    }
+    if (i + 1 == argc) usage(argv[0]);
+    const char *opt = argv[i];
+    const char *val = argv[++i];
+    if (strcmp(opt, "--search") == 0) {
+      if (strcmp(val, "swap") == 0) search_method = SEARCH_SWAP;
+      else if (strcmp(val, "2opt") == 0) search_method = SEARCH_2OPT;
+      else if (strcmp(val, "lk") == 0) search_method = SEARCH_LK;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--lk-depth") == 0) {
+      lk_max_depth = (int)load_long(val);
+      if (lk_max_depth < 1) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--tour") == 0) {
+      if (strcmp(val, "array") == 0) tour_kind = TOUR_ARRAY;
+      else if (strcmp(val, "2level") == 0) tour_kind = TOUR_2LEVEL;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--init") == 0) {
+      if (strcmp(val, "random") == 0) init_method = INIT_RANDOM;
+      else if (strcmp(val, "nn") == 0) init_method = INIT_NN;
+      else if (strcmp(val, "greedy") == 0) init_method = INIT_GREEDY;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--neighbors") == 0) {
+      num_neighbor = (int)load_long(val);
+      if (num_neighbor < 1) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--dist") == 0) {
+      if (strcmp(val, "full") == 0) dist_kind = DM_FULL_F64;
+      else if (strcmp(val, "float") == 0) dist_kind = DM_FULL_F32;
+      else if (strcmp(val, "tri") == 0) dist_kind = DM_TRI_F64;
+      else if (strcmp(val, "tri-float") == 0) dist_kind = DM_TRI_F32;
+      else if (strcmp(val, "int") == 0) dist_kind = DM_FULL_I32;
+      else if (strcmp(val, "tri-int") == 0) dist_kind = DM_TRI_I32;
+      else if (strcmp(val, "none") == 0) dist_kind = DM_IMPLICIT;
+      else usage(argv[0]);
+      dist_given = 1;
+    }
+    else if (strcmp(opt, "--metric") == 0) {
+      if (strcmp(val, "euclid") == 0) metric = DM_EUCLID;
+      else if (strcmp(val, "euc2d") == 0) metric = DM_EUC2D;
+      else usage(argv[0]);
+    }
+    else if (strcmp(opt, "--dist-mem") == 0) {
+      dist_mem_limit = (size_t)load_long(val) << 20;
+    }
+    else if (strcmp(opt, "--time-limit") == 0) {
+      char *e;
+      time_limit = strtod(val, &e);
+      if (*e != '\0' || time_limit <= 0) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--ga") == 0) {
+      ga_pop = (int)load_long(val);
+      if (ga_pop < 2) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--generations") == 0) {
+      ga_generations = (int)load_long(val);
+      if (ga_generations < 0) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--window") == 0) {
+      window_size = (int)load_long(val);
+      if (window_size < 3 || window_size > window_max) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--exact") == 0) {
+      char *e;
+      exact_limit = strtod(val, &e);
+      if (*e != '\0' || exact_limit < 0) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--gap") == 0) {
+      char *e;
+      gap_pct = strtod(val, &e);
+      if (*e != '\0' || gap_pct < 0) usage(argv[0]);
+    }
+    else if (strcmp(opt, "--seed") == 0) {
+      char *e;
+      errno = 0;
+      seed = strtoull(val, &e, 10);
+      if (errno == ERANGE || *e != '\0') usage(argv[0]);
+      seed_given = 1;
+    }
+    else if (strcmp(opt, "--batch") == 0) {
+      batch_path = val;
+    }
+    else if (strcmp(opt, "--stats") == 0) {
+      stats_path = val;
+    }
+    else if (strcmp(opt, "--threads") == 0) {
+      num_threads = (int)load_long(val);
+      if (num_threads < 0) usage(argv[0]);
+    }
+    else {
+      usage(argv[0]);
+    }
+  }
+  if (ga_pop > 0 && time_limit > 0) usage(argv[0]);
+  if (metric == DM_EUC2D && !dist_given) dist_kind = DM_FULL_I32;
+  if (metric == DM_EUCLID && (dist_kind == DM_FULL_I32 || dist_kind == DM_TRI_I32)) usage(argv[0]);
+  if (num_threads == 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  // 同じシードを --seed に渡せば同じ結果を再現できる (--time-limit を除く)
+  if (!seed_given) fprintf(stderr, "seed = %llu\n", (unsigned long long)seed);
 
-  if (argc == 3) {
-    char *e;
-    errno = 0;
-    num_initial_solution = strtol(argv[2], &e, 10);
-    if (errno == ERANGE) {
-      fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+  FILE *stats_fp = NULL;
+  if (stats_path != NULL) {
+    stats_fp = (strcmp(stats_path, "-") == 0) ? stdout : fopen(stats_path, "w");
+    if (stats_fp == NULL) {
+      fprintf(stderr, "%s: %s\n", stats_path, strerror(errno));
       exit(1);
-    } 
-    else if (*e != '\0') {
-      fprintf(stderr, "irregular character %s found in %s\n", e, argv[2]);
     }
   }
-  // 町の初期配置を表示
-  // plot_cities(fp, map, city, n, NULL);
-  sleep(1);
 
-  // 訪れる順序を記録する配列を設定
-  int *route = (int*)calloc(n, sizeof(int));
-  // 訪れた町を記録するフラグ
-  // int *visited = (int*)calloc(n, sizeof(int));
+  if (batch_path != NULL) {
+    // --batch では位置引数は初期解の数だけ
+    if (num_positional == 2) usage(argv[0]);
+    if (num_positional == 1) num_initial_solution = load_long(positional[0]);
+    const int status = run_batch(batch_path, num_initial_solution, num_threads, seed, gap_pct, stats_fp);
+    if (stats_fp != NULL && stats_fp != stdout) fclose(stats_fp);
+    return status;
+  }
 
-  Answer ans = (Answer){ .dist = INF, .route = route};
-  Answer tmp;
-  for (int i = 0; i < num_initial_solution; i++) {// とりあえず初期解5個
-    tmp = solve(city, n);
-    if (ans.dist > tmp.dist) {
-      ans.dist = tmp.dist;
-      memcpy(ans.route, tmp.route, sizeof(int) * n);
-    }
-    free(tmp.route);
+  if (num_positional == 0) usage(argv[0]);
+  int n;
+
+  City *city;
+  DistMatrix matrix; // 距離行列ファイルのとき (city は NULL)
+  if (load_instance(positional[0], &city, &matrix, &n) != 0) exit(1);
+
+  if (num_positional == 2) {
+    num_initial_solution = load_long(positional[1]);
   }
+
+  // 町の初期配置を表示
+  // plot_cities(fp, map, city, n, NULL);
+  if (time_limit == 0) sleep(1); // 時間制限があるときは待たない
+
+  // 訪れる順序を記録する配列は solve_instance が確保する
+  double lower_bound;
+  Stats st;
+  Answer ans = solve_instance(city, (city == NULL) ? &matrix : NULL, n, num_initial_solution, num_threads, seed,
+                              gap_pct, &lower_bound, &st);
+  int *route = ans.route;
   
   if (ans.dist == INF) {
     printf("Failed to solve the problem\n");
@@ -157,27 +567,41 @@ int main(int argc, char**argv)
 
   // plot_cities(fp, map, city, n, ans.route);
   printf("total distance = %f\n", ans.dist);
+  if (lower_bound > 0) {
+    printf("lower bound = %f (gap %.3f%%)\n", lower_bound, (ans.dist - lower_bound) / lower_bound * 100);
+  }
   for (int i = 0 ; i < n ; i++){
     printf("%d -> ", ans.route[i]);
   }
   printf("0\n");
+  if (stats_fp != NULL) {
+    write_stats(stats_fp, positional[0], n, num_threads, ans.dist, lower_bound, &st);
+    if (stats_fp != stdout) fclose(stats_fp);
+  }
 
   // 動的確保した環境ではfreeをする
   free(route);
   // free(visited);
   free(city);
+  dm_free(&matrix);
   
   return 0;
 }
 
-// 繋がっている都市間に線を引く
+// 地図の中の点か (gencity に幅と高さを渡すと、町が描画の範囲の外に出ることがある)
+static inline int in_map(Map map, int x, int y)
+{
+  return 0 <= x && x < map.width && 0 <= y && y < map.height;
+}
+
+// 繋がっている都市間に線を引く (地図の外の部分は描かない)
 void draw_line(Map map, City a, City b)
 {
   const int n = max(abs(a.x - b.x), abs(a.y - b.y));
   for (int i = 1 ; i <= n ; i++){
     const int x = a.x + i * (b.x - a.x) / n;
     const int y = a.y + i * (b.y - a.y) / n;
-    if (map.dot[x][y] == ' ') map.dot[x][y] = '*';
+    if (in_map(map, x, y) && map.dot[x][y] == ' ') map.dot[x][y] = '*';
   }
 }
 
@@ -205,7 +629,7 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
     for (int j = 0; j < strlen(buf); j++) {
       const int x = city[i].x + j;
       const int y = city[i].y;
-      map.dot[x][y] = buf[j];
+      if (in_map(map, x, y)) map.dot[x][y] = buf[j];
     }
   }
 
@@ -221,98 +645,1826 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
+void gen_random_permutation(int *pattern, int n) {
+  // 町0を先頭に固定し、残りをその場でシャッフルする (大きな n でもスタックを使わない)
+  for (int i = 0; i < n; i++) pattern[i] = i;
+  for (int i = n-1; i > 1; i--) {
+    int idx = 1 + rng_below(&rng, i);
+    swap(&pattern[i], &pattern[idx]);
+  }
+}
+
+// 町0が先頭になるように巡回路を回転する (buf は n 要素の作業領域)
+void rotate_route(int *route, int n, int *buf)
 {
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
+  int shift = 0;
+  while (route[shift] != 0) shift++;
+  if (shift == 0) return;
+  for (int i = 0; i < n; i++) buf[i] = route[(i + shift) % n];
+  memcpy(route, buf, sizeof(int) * n);
 }
 
-void gen_random_permutation(int *pattern, int n) {
-  // srand(time(NULL));
-  pattern[0] = 0;
+// 町 start から、まだ訪れていない最も近い町へ進む最近傍法
+// g はすべての町の索引。取り除いた町は最後に戻す
+void nearest_neighbor_tour(Grid *g, int n, int start, int *route)
+{
+  int cur = start;
+  grid_remove(g, cur);
+  route[0] = cur;
+  for (int i = 1; i < n; i++) {
+    cur = grid_nearest(g, cur);
+    grid_remove(g, cur);
+    route[i] = cur;
+  }
+  grid_reset(g);
+}
 
-  int num = n-1;
-  int stock[num];
-  for (int i = 0; i < num; i++) {
-    stock[i] = i+1;
+// 座標がない (距離行列ファイル) ときの最近傍法。O(n^2)。buf は n 要素の作業領域
+void nearest_neighbor_scan(int n, int start, int *route, int *buf)
+{
+  int left = 0; // buf[0..left) がまだ訪れていない町
+  for (int c = 0; c < n; c++) {
+    if (c != start) buf[left++] = c;
   }
-  
-  for (int i = 0; i < num; i++) {
-    int idx = rand() % (num-i);
-    pattern[i+1] = stock[idx];
+  route[0] = start;
+  for (int i = 1; i < n; i++) {
+    int k = 0;
+    for (int t = 1; t < left; t++) {
+      if (dist(route[i-1], buf[t]) < dist(route[i-1], buf[k])) k = t;
+    }
+    route[i] = buf[k];
+    buf[k] = buf[--left];
+  }
+}
+
+typedef struct
+{
+  float d;
+  int a;
+  int b;
+} Edge;
 
-    int tmp = stock[idx];
-    stock[idx] = stock[num-i-1];
-    stock[num-i-1] = tmp;
+int cmp_edge(const void *x, const void *y)
+{
+  const float a = ((const Edge*)x)->d;
+  const float b = ((const Edge*)y)->d;
+  return (a > b) - (a < b);
+}
+
+int uf_find(int *parent, int c)
+{
+  while (parent[c] != c) {
+    parent[c] = parent[parent[c]];
+    c = parent[c];
+  }
+  return c;
+}
+
+// 貪欲法: 近傍リストの辺を短い順に、次数2以下・閉路なしを保ってつなぐ
+// 残った断片は、端点の空間索引を使って最近傍の断片の端へつなぐ (座標がなければ端点を全部調べる)
+int *greedy_edge_tour(const City *city, int n)
+{
+  const int k = min(10, n-1);
+  int *nb = build_neighbor_lists(city, n, k);
+  Edge *edge = (Edge*)malloc(sizeof(Edge) * n * k);
+  long m = 0;
+  for (int c = 0; c < n; c++) {
+    for (int j = 0; j < k; j++) {
+      const int o = nb[c * k + j];
+      if (o < c) {
+        // 相手のリストにも c があれば、その辺はもう入っている
+        int dup = 0;
+        for (int t = 0; t < k; t++) dup |= (nb[o * k + t] == c);
+        if (dup) continue;
+      }
+      edge[m++] = (Edge){ .d = (float)exact_dist(city, c, o), .a = c, .b = o };
+    }
+  }
+  free(nb);
+  qsort(edge, m, sizeof(Edge), cmp_edge);
+
+  int *adj = (int*)malloc(sizeof(int) * 2 * n);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  for (int c = 0; c < n; c++) {
+    adj[2*c] = adj[2*c+1] = -1;
+    parent[c] = c;
+  }
+  for (long e = 0; e < m; e++) {
+    const int a = edge[e].a;
+    const int b = edge[e].b;
+    if (adj[2*a+1] >= 0 || adj[2*b+1] >= 0) continue;
+    const int ra = uf_find(parent, a);
+    const int rb = uf_find(parent, b);
+    if (ra == rb) continue;
+    parent[ra] = rb;
+    adj[2*a + (adj[2*a] >= 0)] = b;
+    adj[2*b + (adj[2*b] >= 0)] = a;
+  }
+  free(edge);
+
+  // 断片の端点と、その反対側の端点を求める
+  int *other_end = parent; // 使い回す
+  int *ends = (int*)malloc(sizeof(int) * n);
+  int num_ends = 0;
+  for (int c = 0; c < n; c++) other_end[c] = -1;
+  for (int c = 0; c < n; c++) {
+    if (adj[2*c+1] >= 0 || other_end[c] >= 0) continue;
+    int prev = -1, cur = c;
+    while (1) {
+      const int nxt = (adj[2*cur] != prev) ? adj[2*cur] : adj[2*cur+1];
+      if (nxt < 0) break;
+      prev = cur;
+      cur = nxt;
+    }
+    other_end[c] = cur;
+    other_end[cur] = c;
+    ends[num_ends++] = c;
+    if (cur != c) ends[num_ends++] = cur;
   }
+
+  int *route = (int*)malloc(sizeof(int) * n);
+  Grid eg = { 0 };
+  char *taken = NULL; // 座標がないとき: つないだ断片の端点
+  if (city != NULL) eg = grid_build(city, n, ends, num_ends);
+  else taken = (char*)calloc(n, 1);
+  int len = 0;
+  int e = ends[0];
+  while (e >= 0) {
+    if (city != NULL) {
+      grid_remove(&eg, e);
+      grid_remove(&eg, other_end[e]);
+    }
+    else {
+      taken[e] = taken[other_end[e]] = 1;
+    }
+    int prev = -1, cur = e;
+    while (cur >= 0) {
+      route[len++] = cur;
+      const int nxt = (adj[2*cur] != prev) ? adj[2*cur] : adj[2*cur+1];
+      prev = cur;
+      cur = nxt;
+    }
+    if (city != NULL) {
+      e = grid_nearest(&eg, other_end[e]);
+      continue;
+    }
+    const int from = other_end[e];
+    e = -1;
+    for (int t = 0; t < num_ends; t++) {
+      const int c = ends[t];
+      if (!taken[c] && (e < 0 || dist(from, c) < dist(from, e))) e = c;
+    }
+  }
+  assert(len == n);
+  grid_free(&eg);
+  free(taken);
+  rotate_route(route, n, ends);
+  free(ends);
+  free(adj);
+  free(parent);
+  return route;
+}
+
+// 距離表を使わず座標から計算した巡回路の長さ (--metric の測り方で。距離行列ファイルなら表から)
+double route_length(const City *city, const int *route, int n)
+{
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += exact_dist(city, route[i], route[(i+1)%n]);
+  }
+  return sum;
 }
 
-double total_distance(const City *city, int *route, int n) {
+double total_distance(int *route, int n) {
   double sum = 0;
   for (int i = 0; i < n; i++) {
     const int c0 = route[i];
     const int c1 = route[(i+1)%n];
-    sum += distance(city[c0], city[c1]);
+    sum += dist(c0, c1);
   }
   return sum;
 }
 
-Answer yamanobori(const City *city, int *route, int n) {
-  
-  // 渡された配列の近傍を取る前に、距離を計算しておく
-  int *arg = (int*)calloc(n, sizeof(int));
-  memcpy(arg, route, sizeof(int) * n);
-  Answer origin = (Answer){ .dist = 0, .route = arg};
-  origin.dist = total_distance(city, route, n);
-
-  int hamming2_route[n];
-  // memcpy(hamming2_route, route, sizeof(int) * n);
-  for (int i = 0; i < n; i++) hamming2_route[i] = route[i]; 
+// 位置iとjの都市を入れ替えたときの距離の増分を、変化する辺だけから計算する
+// 隣接する場合は3辺、そうでなければ4辺が入れ替わる (route[0]は固定なので 1 <= i < j < n)
+// 隣接する場合の a -> b が b -> a になる分は、対称なら 0 なので最後に括弧でまとめて足す (非対称な距離行列用)
+double swap_delta(const int *route, int n, int i, int j) {
+  const int a = route[i];
+  const int b = route[j];
+  const int pa = route[i-1];
+  const int nb = route[(j+1)%n];
+
+  if (j == i+1) {
+    return dist(pa, b) + dist(a, nb)
+      - dist(pa, a) - dist(b, nb) + (dist(b, a) - dist(a, b));
+  }
+  const int na = route[i+1];
+  const int pb = route[j-1];
+  return dist(pa, b) + dist(b, na)
+    + dist(pb, a) + dist(a, nb)
+    - dist(pa, a) - dist(a, na)
+    - dist(pb, b) - dist(b, nb);
+}
+
+// route (長さ dist) の入れ替え近傍で最も良い移動をその場で適用する
+// 改善しなければ route も dist もそのまま返す
+Answer yamanobori(int *route, int n, double cur_dist) {
   
-  // ハミング距離2のルートの距離を計算し、短いものがあれば更新する
+  Answer origin = (Answer){ .dist = cur_dist, .route = route};
+
+  // ハミング距離2のルートの距離を差分で計算し、最も短くなる入れ替えを選ぶ
+  // 1パスあたり O(n^2) (以前は毎回 total_distance を呼んでいたので O(n^3))
+  double best_delta = 0;
+  int best_i = -1, best_j = -1;
+  stats.passes++;
+  stats.moves_evaluated += (long)(n-1) * (n-2) / 2;
   for (int i = 1; i < n-1; i++) {
     for (int j = i+1; j < n; j++) {
-      swap(&hamming2_route[i], &hamming2_route[j]);
-      // int now = hamming2_route[i];
-      // hamming2_route[i] = hamming2_route[j];
-      // hamming2_route[j] = now;
-      
-      double tmp = total_distance(city, hamming2_route, n);
-      if (origin.dist > tmp) {
-        origin.dist = tmp;
-        memcpy(origin.route, hamming2_route, sizeof(int) * n);
+      const double delta = swap_delta(route, n, i, j);
+#ifdef VERIFY_DELTA
+      // 検証モード: 実際に入れ替えて全体の距離を計算し直し、差分と比較する
+      swap(&route[i], &route[j]);
+      const double full = total_distance(route, n);
+      swap(&route[i], &route[j]);
+      assert(fabs(origin.dist + delta - full) < 1e-6);
+#endif
+      if (best_delta > delta) {
+        best_delta = delta;
+        best_i = i;
+        best_j = j;
       }
-      swap(&hamming2_route[i], &hamming2_route[j]);
-      // now = hamming2_route[i];
-      // hamming2_route[i] = hamming2_route[j];
-      // hamming2_route[j] = now;
     }
   }
+  if (best_i >= 0 && best_delta < -1e-9) { // 丸め誤差だけの改善は採用しない
+    swap(&route[best_i], &route[best_j]);
+    origin.dist += best_delta;
+    stats.improving_moves++;
+  }
   return origin;
 }
 
-Answer solve(const City *city, int n) { //山登り法としてはsolveだが、最適解を求めてはいない
-  
-  int *route = (int*)calloc(n, sizeof(int)); //137行目でfreeしている
-  
-  gen_random_permutation(route, n); //初期解をセット
-  double origin_distance = total_distance(city, route, n);
+// 各町について近い順に k 個の町を並べた近傍リストを作る (空間索引で探すので O(n k) 程度)
+// 座標がなければ (距離行列ファイル)、距離表の各行から挿入ソートで選ぶ (O(n^2 k))
+int *build_neighbor_lists(const City *city, int n, int k)
+{
+  int *list = (int*)malloc(sizeof(int) * n * k);
+  double *d2 = (double*)malloc(sizeof(double) * k);
+  if (city == NULL) {
+    for (int c = 0; c < n; c++) {
+      int *row = list + c * k;
+      int cnt = 0;
+      for (int o = 0; o < n; o++) {
+        if (o == c) continue;
+        const double d = dist(c, o);
+        if (cnt == k && d >= d2[k-1]) continue;
+        int p = (cnt < k) ? cnt++ : k - 1;
+        while (p > 0 && d2[p-1] > d) {
+          d2[p] = d2[p-1];
+          row[p] = row[p-1];
+          p--;
+        }
+        d2[p] = d;
+        row[p] = o;
+      }
+    }
+    free(d2);
+    return list;
+  }
+  Grid g = grid_build(city, n, NULL, n);
+  for (int c = 0; c < n; c++) {
+    grid_knn(&g, c, k, list + c * k, d2);
+  }
+  grid_free(&g);
+  free(d2);
+  return list;
+}
+
+int tour_next(const Tour *t, int c)
+{
+  if (t->kind == TOUR_2LEVEL) return tl_next(t->tl, c);
+  const int i = t->pos[c] + 1;
+  return t->route[(i == t->n) ? 0 : i];
+}
+
+int tour_prev(const Tour *t, int c)
+{
+  if (t->kind == TOUR_2LEVEL) return tl_prev(t->tl, c);
+  const int i = t->pos[c];
+  return t->route[(i == 0) ? t->n - 1 : i - 1];
+}
+
+// a から巡回路の向きにたどって c に着くまでに b を通るか
+int tour_between(const Tour *t, int a, int b, int c)
+{
+  if (t->kind == TOUR_2LEVEL) return tl_between(t->tl, a, b, c);
+  const int n = t->n;
+  const int pa = t->pos[a];
+  return (t->pos[b] - pa + n) % n <= (t->pos[c] - pa + n) % n;
+}
+
+// 順番 i から j まで (巡回的に) を反転する。反転は補集合側でも同じ巡回路になるので短い方を反転する
+void tour_reverse(Tour *t, int i, int j)
+{
+  const int n = t->n;
+  int len = j - i;
+  if (len < 0) len += n;
+  len += 1;
+  if (2 * len > n) {
+    const int tmp = i;
+    i = (j + 1 == n) ? 0 : j + 1;
+    j = (tmp == 0) ? n - 1 : tmp - 1;
+    len = n - len;
+  }
+  for (int k = 0; k < len / 2; k++) {
+    const int a = t->route[i];
+    const int b = t->route[j];
+    t->route[i] = b;
+    t->pos[b] = i;
+    t->route[j] = a;
+    t->pos[a] = j;
+    if (++i == n) i = 0;
+    if (--j < 0) j = n - 1;
+  }
+}
+
+// 辺(a,b), (c,d) を取り除き (a,c), (b,d) をつなぐ (d は a->b と同じ向きで c の次の町なので渡さない)
+// a->b, c->d が同じ向きに並んでいれば、巡回路の向きはどちらでもよい
+void two_opt_move(Tour *t, int a, int b, int c)
+{
+  if (t->kind == TOUR_2LEVEL) {
+    if (tour_next(t, a) == b) tl_reverse(t->tl, b, c);
+    else tl_reverse(t->tl, c, b);
+    return;
+  }
+  if (tour_next(t, a) == b) tour_reverse(t, t->pos[b], t->pos[c]);
+  else tour_reverse(t, t->pos[c], t->pos[b]);
+}
+
+// ws->route から局所探索用の巡回路を作る
+Tour tour_open(Workspace *ws)
+{
+  Tour t = { .n = ws->n, .kind = ws->tour_kind, .route = ws->route, .pos = ws->pos, .tl = &ws->tl };
+  if (t.kind == TOUR_2LEVEL) tl_load(t.tl, ws->route);
+  else for (int i = 0; i < t.n; i++) t.pos[t.route[i]] = i;
+  return t;
+}
+
+// 巡回路を ws->route に町0から書き戻す
+void tour_close(Tour *t, Workspace *ws)
+{
+  if (t->kind == TOUR_2LEVEL) tl_store(t->tl, ws->route);
+  else rotate_route(ws->route, ws->n, ws->buf);
+}
+
+double tour_length(const Tour *t)
+{
+  double sum = 0;
+  int c = 0;
+  for (int i = 0; i < t->n; i++) {
+    const int nx = tour_next(t, c);
+    sum += dist(c, nx);
+    c = nx;
+  }
+  return sum;
+}
+
+void queue_push(Queue *q, int c)
+{
+  if (q->active[c]) return;
+  q->active[c] = 1;
+  int tail = q->head + q->count;
+  if (tail >= q->n) tail -= q->n;
+  q->buf[tail] = c;
+  q->count++;
+}
+
+int queue_pop(Queue *q)
+{
+  const int c = q->buf[q->head];
+  if (++q->head == q->n) q->head = 0;
+  q->count--;
+  q->active[c] = 0;
+  return c;
+}
+
+// 町aを端点とする 2-opt を近傍リストから探し、改善すれば適用して増分を返す
+double improve_2opt(Tour *t, Queue *q, int a)
+{
+  const int *nb = inst.neighbor + a * inst.num_neighbor;
+  for (int dir = 0; dir < 2; dir++) {
+    const int b = (dir == 0) ? tour_next(t, a) : tour_prev(t, a);
+    const double dab = dist(a, b);
+    for (int k = 0; k < inst.num_neighbor; k++) {
+      const int c = nb[k];
+      const double dac = dist(a, c);
+      if (dac >= dab) break; // 新しい辺(a,c)が元の辺より長ければ改善しない
+      const int d = (dir == 0) ? tour_next(t, c) : tour_prev(t, c);
+      if (c == b || d == a) continue;
+      const double delta = dac + dist(b, d) - dab - dist(c, d);
+      stats.moves_evaluated++;
+      if (delta < -1e-9) {
+        stats.improving_moves++;
+        if (dir == 0) two_opt_move(t, a, b, c);
+        else two_opt_move(t, b, a, d);
+        queue_push(q, a);
+        queue_push(q, b);
+        queue_push(q, c);
+        queue_push(q, d);
+        return delta;
+      }
+    }
+  }
+  return 0;
+}
+
+// 町aを端とする長さ1~3の区間を、近傍の町の隣へ (向きも含めて) 移す Or-opt
+double improve_oropt(Tour *t, Queue *q, int a)
+{
+  if (t->n < 8) return 0;
+  for (int len = 1; len <= 3; len++) {
+    for (int side = 0; side < ((len == 1) ? 1 : 2); side++) {
+      // 区間 s1..s2 (前向き)
+      int s1 = a, s2 = a;
+      for (int k = 1; k < len; k++) {
+        if (side == 0) s2 = tour_next(t, s2);
+        else s1 = tour_prev(t, s1);
+      }
+      const int mid = (len == 3) ? tour_next(t, s1) : s1;
+      const int p = tour_prev(t, s1);
+      const int nx = tour_next(t, s2);
+      const double remove_gain = dist(p, s1) + dist(s2, nx)
+        - dist(p, nx);
+      if (remove_gain <= 1e-9) continue;
+
+      for (int e = 0; e < 2; e++) {
+        const int end = (e == 0) ? s1 : s2;
+        const int *nb = inst.neighbor + end * inst.num_neighbor;
+        for (int k = 0; k < inst.num_neighbor; k++) {
+          const int c = nb[k];
+          if (dist(end, c) >= remove_gain) break;
+          if (c == s1 || c == s2 || c == mid) continue;
+          // c の前後どちらの辺 (g1 -> g2) に挿入するか
+          for (int g = 0; g < 2; g++) {
+            const int g1 = (g == 0) ? c : tour_prev(t, c);
+            const int g2 = (g == 0) ? tour_next(t, c) : c;
+            if (g1 == s2 || g2 == s1 || g1 == mid || g2 == mid) continue;
+            const double dg = dist(g1, g2);
+            const double fwd = dist(g1, s1) + dist(s2, g2) - dg;
+            const double rev = dist(g1, s2) + dist(s1, g2) - dg;
+            const double add = (fwd < rev) ? fwd : rev;
+            stats.moves_evaluated++;
+            if (add - remove_gain < -1e-9) {
+              stats.improving_moves++;
+              // 3回の 2-opt 移動で区間を移す (最後の1回は向きを戻すため)
+              two_opt_move(t, p, s1, g1);
+              two_opt_move(t, p, g1, nx);
+              if (fwd < rev) two_opt_move(t, g1, s2, s1);
+              queue_push(q, p);
+              queue_push(q, nx);
+              queue_push(q, s1);
+              queue_push(q, s2);
+              queue_push(q, g1);
+              queue_push(q, g2);
+              return add - remove_gain;
+            }
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// 2-opt + Or-opt による局所探索。ws->route をその場で書き換え、route[0] = 0 にそろえて返す
+Answer two_opt_oropt(Workspace *ws)
+{
+  const int n = ws->n;
+  int *route = ws->route;
+  Queue q = ws->q; // 前回の探索で空になっている
+  Tour t = tour_open(ws);
+
+  for (int i = 0; i < n; i++) queue_push(&q, route[i]);
+  while (q.count > 0) {
+    const int a = queue_pop(&q);
+    stats.passes++;
+    if (improve_2opt(&t, &q, a) < 0) continue;
+    improve_oropt(&t, &q, a);
+  }
+
+  tour_close(&t, ws);
+  return (Answer){ .dist = total_distance(route, n), .route = route };
+}
+
+// LK の探索状態
+typedef struct
+{
+  Tour *t;
+  int *log;     // 適用した 2-opt 移動 (4町ずつ)。失敗したら逆順に戻す
+  int num_log;
+  int *mark;    // mark[c] == stamp の町は、この探索ですでに辺を外した町
+  int stamp;
+} LKState;
+
+// 2-opt 移動を適用して記録する
+void lk_flip(LKState *lk, int a, int b, int c, int d)
+{
+  two_opt_move(lk->t, a, b, c);
+  int *e = lk->log + 4 * lk->num_log++;
+  e[0] = a;
+  e[1] = b;
+  e[2] = c;
+  e[3] = d;
+}
+
+// 最後の移動を取り消す ((a,c), (b,d) を外して (a,b), (c,d) に戻す)
+void lk_undo(LKState *lk)
+{
+  const int *e = lk->log + 4 * --lk->num_log;
+  two_opt_move(lk->t, e[0], e[2], e[1]);
+}
+
+// 辺 (t1,t2) を外した状態から、t2 に新しい辺 (t2,t3) をつなぎ (t4,t3) を外す移動を連鎖させる
+// g はここまでの利得 (外した辺 - つないだ辺, 閉じる辺 (t_last,t1) は含まない)
+// floor より大きな利得で巡回路を閉じられたら、その状態のまま利得を返す。だめなら元に戻して 0
+// 浅いレベルでは複数の候補を試し (5, 3)、深いところでは最良の1つだけをたどる
+double lk_search(LKState *lk, int level, int t1, int t2, double g, double floor)
+{
+  if (level > lk_max_depth) return 0;
+  Tour *t = lk->t;
+  const int forward = (tour_next(t, t1) == t2);
+  const int breadth = (level == 1) ? 5 : (level == 2) ? 3 : 1;
+
+  // 候補 (t3, t4) を d(t4,t3) - d(t2,t3) の大きい順に breadth 個選ぶ
+  int cand3[5], cand4[5];
+  double value[5];
+  int num_cand = 0;
+  const int *nb = inst.neighbor + t2 * inst.num_neighbor;
+  for (int k = 0; k < inst.num_neighbor; k++) {
+    const int t3 = nb[k];
+    const double g1 = g - dist(t2, t3);
+    if (g1 <= 1e-9) break;
+    if (t3 == t1) continue;
+    const int t4 = forward ? tour_prev(t, t3) : tour_next(t, t3);
+    if (t4 == t2 || lk->mark[t4] == lk->stamp) continue;
+    stats.moves_evaluated++;
+    const double v = dist(t4, t3) - dist(t2, t3);
+    if (num_cand == breadth && v <= value[breadth-1]) continue;
+    int j = (num_cand < breadth) ? num_cand++ : breadth - 1;
+    while (j > 0 && value[j-1] < v) {
+      value[j] = value[j-1];
+      cand3[j] = cand3[j-1];
+      cand4[j] = cand4[j-1];
+      j--;
+    }
+    value[j] = v;
+    cand3[j] = t3;
+    cand4[j] = t4;
+  }
+
+  for (int k = 0; k < num_cand; k++) {
+    const int t3 = cand3[k];
+    const int t4 = cand4[k];
+    const double g1 = g - dist(t2, t3) + dist(t4, t3);
+    lk_flip(lk, t1, t2, t4, t3); // (t1,t4), (t2,t3) をつなぐ
+    lk->mark[t4] = lk->stamp;
+    const double close = g1 - dist(t4, t1);
+    const double next_floor = (close > floor) ? close : floor;
+    const double deeper = lk_search(lk, level + 1, t1, t4, g1, next_floor);
+    if (deeper > next_floor) return deeper;
+    if (close > floor) return close;
+    lk_undo(lk);
+  }
+  return 0;
+}
+
+// Lin-Kernighan 風の局所探索 (Or-3opt 相当の可変深さ探索)
+// 各町 t1 について両隣の辺から lk_search を始め、改善がなければ Or-opt を試す
+Answer lin_kernighan(Workspace *ws)
+{
+  const int n = ws->n;
+  int *route = ws->route;
+  Queue q = ws->q;
+  Tour t = tour_open(ws);
+  LKState lk = { .t = &t, .log = ws->lk_log, .num_log = 0, .mark = ws->lk_mark, .stamp = ws->lk_stamp };
+
+  for (int i = 0; i < n; i++) queue_push(&q, route[i]);
+  while (q.count > 0) {
+    const int t1 = queue_pop(&q);
+    stats.passes++;
+    int improved = 0;
+    for (int dir = 0; dir < 2 && !improved && n >= 5; dir++) {
+      const int t2 = (dir == 0) ? tour_next(&t, t1) : tour_prev(&t, t1);
+      lk.num_log = 0;
+      if (++lk.stamp == 0x7fffffff) { // 一周したら印を消してやり直す
+        memset(lk.mark, 0, sizeof(int) * n);
+        lk.stamp = 1;
+      }
+      lk.mark[t1] = lk.mark[t2] = lk.stamp;
+#ifdef VERIFY_DELTA
+      const double before = tour_length(&t);
+#endif
+      const double gain = lk_search(&lk, 1, t1, t2, dist(t1, t2), 1e-9);
+#ifdef VERIFY_DELTA
+      assert(fabs(before - gain - tour_length(&t)) < 1e-6);
+#endif
+      if (gain > 0) {
+        improved = 1;
+        stats.improving_moves++;
+        for (int k = 0; k < 4 * lk.num_log; k++) queue_push(&q, lk.log[k]);
+      }
+    }
+    if (!improved) {
+#ifdef VERIFY_DELTA
+      const double before = tour_length(&t);
+      const double delta = improve_oropt(&t, &q, t1);
+      assert(fabs(before + delta - tour_length(&t)) < 1e-6);
+#else
+      improve_oropt(&t, &q, t1);
+#endif
+    }
+  }
+
+  ws->lk_stamp = lk.stamp;
+  tour_close(&t, ws);
+  return (Answer){ .dist = total_distance(route, n), .route = route };
+}
+
+Workspace *workspace_new(const City *city, int n)
+{
+  Workspace *ws = (Workspace*)calloc(1, sizeof(Workspace));
+  ws->n = n;
+  ws->route = (int*)malloc(sizeof(int) * n);
+  ws->best = (int*)malloc(sizeof(int) * n);
+  ws->pos = (int*)malloc(sizeof(int) * n);
+  ws->buf = (int*)malloc(sizeof(int) * n);
+  ws->q = (Queue){ .buf = (int*)malloc(sizeof(int) * n), .active = (char*)calloc(n, 1),
+                   .head = 0, .count = 0, .n = n };
+  ws->lk_log = (int*)malloc(sizeof(int) * 4 * (lk_max_depth + 1));
+  ws->lk_mark = (int*)calloc(n, sizeof(int));
+  if (init_method == INIT_NN && city != NULL) ws->grid = grid_build(city, n, NULL, n);
+  ws->tour_kind = (tour_kind >= 0) ? tour_kind : (n >= tour_auto_threshold) ? TOUR_2LEVEL : TOUR_ARRAY;
+  if (search_method == SEARCH_SWAP || inst.asymmetric) ws->tour_kind = TOUR_ARRAY;
+  if (ws->tour_kind == TOUR_2LEVEL) tl_alloc(&ws->tl, n);
+  return ws;
+}
+
+void workspace_free(Workspace *ws)
+{
+  free(ws->route);
+  free(ws->best);
+  free(ws->pos);
+  free(ws->buf);
+  free(ws->q.buf);
+  free(ws->q.active);
+  free(ws->lk_log);
+  free(ws->lk_mark);
+  if (init_method == INIT_NN) grid_free(&ws->grid);
+  if (ws->tour_kind == TOUR_2LEVEL) tl_free(&ws->tl);
+  free(ws);
+}
+
+//初期解を ws->route にセット (route[0] = 0)
+void initial_route(const City *city, int n, Workspace *ws)
+{
+  if (init_method == INIT_NN) {
+    if (city != NULL) nearest_neighbor_tour(&ws->grid, n, rng_below(&rng, n), ws->route);
+    else nearest_neighbor_scan(n, rng_below(&rng, n), ws->route, ws->buf);
+    rotate_route(ws->route, n, ws->buf);
+  }
+  else if (init_method == INIT_GREEDY) memcpy(ws->route, inst.greedy_route, sizeof(int) * n);
+  else gen_random_permutation(ws->route, n);
+}
+
+// 返す Answer の route は ws->route を指す (次に solve を呼ぶまで有効)
+Answer solve(const City *city, int n, Workspace *ws) { //山登り法としてはsolveだが、最適解を求めてはいない
+  initial_route(city, n, ws);
+  return local_search(n, ws);
+}
+
+// ws->route (route[0] = 0) を --search で選んだ局所探索で改善する
+Answer local_search(int n, Workspace *ws)
+{
+  int *route = ws->route;
+
+  // 非対称な距離では、区間を反転する 2opt / lk は使わず入れ替え近傍にする
+  if (search_method == SEARCH_2OPT && !inst.asymmetric) {
+    return two_opt_oropt(ws);
+  }
+  if (search_method == SEARCH_LK && !inst.asymmetric) {
+    return lin_kernighan(ws);
+  }
+
+  double origin_distance = total_distance(route, n);
   
   Answer ans = (Answer){ .dist = INF, .route = NULL};
   while (1) {
-    ans = yamanobori(city, route, n);
-    memcpy(route, ans.route, sizeof(int) * n);
+    ans = yamanobori(route, n, origin_distance);
     if (ans.dist == origin_distance) {
       return ans;  //解が更新されなくなったら終了
     } 
+    origin_distance = ans.dist;
+  }
+
+  return ans; 
+}
+
+double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// 入れ替え近傍の焼きなまし法。deadline まで探索し、それまでの最良解を返す
+// 温度は残り時間の割合に合わせて T0 から T1 まで指数的に下げる
+// T0, T1 は最初にランダムな入れ替えで測った、悪化する移動の平均 (avg) から決める
+// found_at には最良解を見つけた時刻 (now_sec) を返す
+Answer anneal(const City *city, int n, double deadline, Workspace *ws, double *found_at)
+{
+  int *route = ws->route;
+  int *best = ws->best;
+  initial_route(city, n, ws);
+  memcpy(best, route, sizeof(int) * n);
+  double cur = total_distance(route, n);
+  double best_dist = cur;
+  *found_at = now_sec();
+  if (n < 4) {
+    return (Answer){ .dist = best_dist, .route = best };
+  }
+
+  double avg = 0;
+  int num_uphill = 0;
+  for (int k = 0; k < 100; k++) {
+    const int i = 1 + rng_below(&rng, n-1);
+    const int j = 1 + rng_below(&rng, n-1);
+    const double delta = (i < j) ? swap_delta(route, n, i, j) : (i > j) ? swap_delta(route, n, j, i) : 0;
+    if (delta > 0) {
+      avg += delta;
+      num_uphill++;
+    }
+  }
+  avg = (num_uphill > 0) ? avg / num_uphill : 1;
+  const double t0 = avg / log(2.0);   // 平均的な悪化を半分の確率で受け入れる
+  const double t1 = avg * 1e-3;
+
+  const double start = now_sec();
+  const double budget = deadline - start;
+  double temp = t0;
+  long iter, num_improving = 0;
+  double last_best = best_dist; // 前のブロックの終わりの最良値
+  for (iter = 0; ; iter++) {
+    if ((iter & 255) == 0) {
+      // 最良解を見つけた時刻は 256 回ごとに記録する (毎回時計を読まない)
+      if (best_dist < last_best) {
+        *found_at = now_sec();
+        last_best = best_dist;
+      }
+      const double frac = (now_sec() - start) / budget;
+      if (frac >= 1 || __atomic_load_n(inst.stop_search, __ATOMIC_RELAXED)) break;
+      if (best_dist <= inst.gap_target) {
+        __atomic_store_n(inst.stop_search, 1, __ATOMIC_RELAXED);
+        break;
+      }
+      temp = t0 * pow(t1 / t0, frac);
+    }
+    int i = 1 + rng_below(&rng, n-1);
+    int j = 1 + rng_below(&rng, n-1);
+    if (i == j) continue;
+    if (i > j) swap(&i, &j);
+    const double delta = swap_delta(route, n, i, j);
+    if (delta <= 0 || rng_unit(&rng) < exp(-delta / temp)) {
+      swap(&route[i], &route[j]);
+      cur += delta;
+      if (delta < 0) num_improving++;
+      if (cur < best_dist - 1e-9) {
+        best_dist = cur;
+        memcpy(best, route, sizeof(int) * n);
+      }
+    }
+  }
+  stats.moves_evaluated += iter;
+  stats.improving_moves += num_improving;
+  return (Answer){ .dist = total_distance(best, n), .route = best };
+}
+
+// 初期解1つ分の時間を記録する
+void stats_restart(Stats *s, double elapsed)
+{
+  if (s->restarts == 0 || s->restart_min > elapsed) s->restart_min = elapsed;
+  if (s->restarts == 0 || s->restart_max < elapsed) s->restart_max = elapsed;
+  s->restart_sum += elapsed;
+  s->restarts++;
+}
+
+// ワーカーの統計を足し合わせる (time_to_best, time_total は呼び出し側で決める)
+void stats_merge(Stats *to, const Stats *from)
+{
+  if (from->restarts > 0) {
+    if (to->restarts == 0 || to->restart_min > from->restart_min) to->restart_min = from->restart_min;
+    if (to->restarts == 0 || to->restart_max < from->restart_max) to->restart_max = from->restart_max;
+  }
+  to->restarts += from->restarts;
+  to->passes += from->passes;
+  to->moves_evaluated += from->moves_evaluated;
+  to->improving_moves += from->improving_moves;
+  to->restart_sum += from->restart_sum;
+  to->windows_solved += from->windows_solved;
+  to->windows_improved += from->windows_improved;
+  to->exact_nodes += from->exact_nodes;
+}
+
+// 統計を JSON で1行に書く
+void write_stats(FILE *fp, const char *file, int n, int num_threads, double best, double lower_bound,
+                 const Stats *s)
+{
+  static const char *search_name[] = { "swap", "2opt", "lk" };
+  fprintf(fp, "{\"file\": \"");
+  for (const char *c = file; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+    else if ((unsigned char)*c < 0x20) fprintf(fp, "\\u%04x", (unsigned char)*c);
+    else fputc(*c, fp);
+  }
+  fprintf(fp, "\", \"n\": %d, \"search\": \"%s\", \"method\": \"%s\", \"metric\": \"%s\", \"threads\": %d",
+          n, search_name[search_method], (ga_pop > 0) ? "ga" : (time_limit > 0) ? "anneal" : "restart",
+          (metric == DM_EUC2D) ? "euc2d" : "euclid", num_threads);
+  if (best == INF) fprintf(fp, ", \"best\": null");
+  else fprintf(fp, ", \"best\": %.6f", best);
+  if (lower_bound > 0) fprintf(fp, ", \"lower_bound\": %.6f", lower_bound);
+  fprintf(fp, ", \"restarts\": %ld, \"passes\": %ld, \"moves_evaluated\": %ld, \"improving_moves\": %ld",
+          s->restarts, s->passes, s->moves_evaluated, s->improving_moves);
+  fprintf(fp, ", \"time_total\": %.6f, \"time_to_best\": %.6f", s->time_total, s->time_to_best);
+  if (window_size > 0) {
+    fprintf(fp, ", \"windows\": {\"solved\": %ld, \"improved\": %ld}", s->windows_solved, s->windows_improved);
+  }
+  if (exact_limit >= 0) {
+    fprintf(fp, ", \"exact\": {\"nodes\": %ld, \"proved\": %s}", s->exact_nodes, s->exact_proved ? "true" : "false");
+  }
+  fprintf(fp, ", \"restart_time\": {\"mean\": %.6f, \"min\": %.6f, \"max\": %.6f}}\n",
+          (s->restarts > 0) ? s->restart_sum / s->restarts : 0, s->restart_min, s->restart_max);
+  fflush(fp);
+}
+
+void *restart_worker(void *arg)
+{
+  Worker *w = (Worker*)arg;
+  inst = *w->inst;
+  stats = (Stats){ 0 };
+  // 作業領域はここで1度だけ確保する。以降の探索ではヒープを確保しない
+  w->ws = workspace_new(w->city, w->n);
+  w->best = (Answer){ .dist = INF, .route = w->ws->best};
+  w->best_restart = -1;
+  if (w->deadline > 0) {
+    // 焼きなましはスレッドごとに1本なので、シードの系列を id 回 jump した重ならない系列を使う
+    rng_init(&rng, w->seed);
+    for (int t = 0; t < w->id; t++) rng_jump(&rng);
+    const double start = now_sec();
+    w->best = anneal(w->city, w->n, w->deadline, w->ws, &w->best_time);
+    stats_restart(&stats, now_sec() - start);
+    w->stats = stats;
+    return NULL;
+  }
+  long k;
+  while (!__atomic_load_n(inst.stop_search, __ATOMIC_RELAXED) &&
+         (k = __atomic_fetch_add(w->next_restart, 1, __ATOMIC_RELAXED)) < w->num_restarts) {
+    rng_init_stream(&rng, w->seed, k);
+    const double start = now_sec();
+    Answer tmp = solve(w->city, w->n, w->ws);
+    const double end = now_sec();
+    stats_restart(&stats, end - start);
+    if (w->best.dist > tmp.dist) {
+      w->best.dist = tmp.dist;
+      w->best_restart = k;
+      w->best_time = end;
+      memcpy(w->best.route, tmp.route, sizeof(int) * w->n);
+      // 目標の長さに届いたら、ほかのワーカーも次の初期解に進まずに止める
+      if (w->best.dist <= inst.gap_target) __atomic_store_n(inst.stop_search, 1, __ATOMIC_RELAXED);
+    }
+  }
+  w->stats = stats;
+  return NULL;
+}
+
+// num_restarts 個の初期解を num_threads 本のスレッドで分担して解き、最良解を返す
+// 初期解はカウンタから1つずつ取るので、時間のかかる初期解があっても偏らない
+// st には全ワーカーの統計の合計を返す
+Answer multi_start(const City *city, int n, long num_restarts, int num_threads, uint64_t seed, Stats *st)
+{
+  const double start = now_sec();
+  long next_restart = 0;
+  const Instance shared = inst; // ワーカーはこれを自分の inst に写す
+  Worker *workers = (Worker*)calloc(num_threads, sizeof(Worker));
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    workers[t] = (Worker){ .city = city, .n = n, .id = t, .seed = seed, .inst = &shared,
+                           .next_restart = &next_restart, .num_restarts = num_restarts,
+                           .deadline = (time_limit > 0) ? now_sec() + time_limit : 0 };
+  }
+  // ワーカー0は呼び出し元のスレッドで動かす
+  for (int t = 1; t < num_threads; t++) {
+    const int err = pthread_create(&threads[t], NULL, restart_worker, &workers[t]);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  restart_worker(&workers[0]);
+
+  // 同じ長さなら番号の小さい初期解の結果を選ぶ (スレッド数によらず同じ解になる)
+  int best = 0;
+  for (int t = 1; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    const Answer *a = &workers[best].best;
+    const Answer *b = &workers[t].best;
+    if (a->dist > b->dist || (a->dist == b->dist && workers[t].best_restart < workers[best].best_restart)) best = t;
+  }
+  if (*inst.stop_search && time_limit == 0) {
+    fprintf(stderr, "reached the target gap after %ld initial solutions\n",
+            (next_restart < num_restarts) ? next_restart : num_restarts);
+  }
+  *st = (Stats){ 0 };
+  for (int t = 0; t < num_threads; t++) stats_merge(st, &workers[t].stats);
+  st->time_to_best = (workers[best].best_restart >= 0 || time_limit > 0) ? workers[best].best_time - start : 0;
+  st->time_total = now_sec() - start;
+  Answer ans = (Answer){ .dist = workers[best].best.dist, .route = (int*)malloc(sizeof(int) * n)};
+  memcpy(ans.route, workers[best].best.route, sizeof(int) * n);
+  for (int t = 0; t < num_threads; t++) workspace_free(workers[t].ws);
+  free(workers);
+  free(threads);
+  return ans;
+}
+
+// 順序交叉 (OX)。pa の区間 [i, j) をそのまま子に写し、残りの位置は j から巡回的に pb の順で埋める
+// used は n 要素の作業領域
+void order_crossover(const int *pa, const int *pb, int n, int *child, int *used)
+{
+  int i = rng_below(&rng, n);
+  int j = rng_below(&rng, n);
+  if (i > j) swap(&i, &j);
+  memset(used, 0, sizeof(int) * n);
+  for (int k = i; k < j; k++) {
+    child[k] = pa[k];
+    used[pa[k]] = 1;
+  }
+  int w = j % n;
+  for (int k = 0; k < n; k++) {
+    const int c = pb[(j + k) % n];
+    if (used[c]) continue;
+    child[w] = c;
+    w = (w + 1) % n;
+  }
+}
+
+// 2つ選んで短い方を返すトーナメント選択
+static const int *ga_select(const GA *ga)
+{
+  const Answer *a = &ga->pool[rng_below(&rng, ga->pop)];
+  const Answer *b = &ga->pool[rng_below(&rng, ga->pop)];
+  return (a->dist <= b->dist) ? a->route : b->route;
+}
+
+static int cmp_answer(const void *x, const void *y)
+{
+  const double a = ((const Answer*)x)->dist;
+  const double b = ((const Answer*)y)->dist;
+  return (a > b) - (a < b);
+}
+
+// 親と子をまとめて短い順に並べ、距離の違う解を優先して pop 個を次の親にする
+// 同じ解ばかりになると交叉しても新しい解が出ないので、重複は後ろに回す
+static void ga_replace(GA *ga)
+{
+  const int m = 2 * ga->pop;
+  qsort(ga->pool, m, sizeof(Answer), cmp_answer);
+  int num_unique = 0, num_dup = 0;
+  for (int k = 0; k < m; k++) {
+    // 世代 0 の親 (INF) も重複として扱う
+    if (ga->pool[k].dist == INF || (num_unique > 0 && ga->pool[k].dist - ga->tmp[num_unique-1].dist < 1e-7)) {
+      ga->tmp[m - 1 - num_dup++] = ga->pool[k];
+    }
+    else ga->tmp[num_unique++] = ga->pool[k];
+  }
+  // 重複は短い順に後ろへ並べ直す
+  for (int k = 0; k < num_dup; k++) ga->pool[num_unique + k] = ga->tmp[m - 1 - k];
+  memcpy(ga->pool, ga->tmp, sizeof(Answer) * num_unique);
+  if (ga->pool[0].dist < ga->best_dist) {
+    ga->best_dist = ga->pool[0].dist;
+    ga->best_time = now_sec();
+  }
+  // 親の世代に違う解が1つしかなければ収束したとみなす
+  if (num_unique == 1 || ga->pool[0].dist <= inst.gap_target) ga->done = 1;
+}
+
+// 1世代ごとに pop 個の子を分担して作り、全員がそろったところでワーカー0が世代交代する
+// 世代 0 の子は初期解 + 局所探索、それ以降は交叉 + 局所探索
+void *ga_worker(void *arg)
+{
+  GAWorker *w = (GAWorker*)arg;
+  GA *ga = w->ga;
+  inst = *w->inst;
+  const int n = ga->n;
+  w->ws = workspace_new(ga->city, n);
+  Workspace *ws = w->ws;
+  stats = (Stats){ 0 };
+  for (int gen = 0; gen <= ga_generations; gen++) {
+    long k;
+    while ((k = __atomic_fetch_add(&ga->next_child, 1, __ATOMIC_RELAXED)) < ga->pop) {
+      rng_init_stream(&rng, w->seed, (uint64_t)gen * ga->pop + k);
+      const double start = now_sec();
+      Answer ans;
+      if (gen == 0) ans = solve(ga->city, n, ws);
+      else {
+        order_crossover(ga_select(ga), ga_select(ga), n, ws->route, ws->pos);
+        rotate_route(ws->route, n, ws->buf);
+        ans = local_search(n, ws);
+      }
+      stats_restart(&stats, now_sec() - start);
+      Answer *child = &ga->pool[ga->pop + k];
+      child->dist = ans.dist;
+      memcpy(child->route, ans.route, sizeof(int) * n);
+    }
+    if (pthread_barrier_wait(&ga->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+      ga_replace(ga);
+      ga->next_child = 0;
+    }
+    pthread_barrier_wait(&ga->barrier);
+    if (ga->done) break;
+  }
+  w->stats = stats;
+  return NULL;
+}
+
+// 集団 ga_pop の遺伝的アルゴリズム (各子を局所探索で磨く memetic 法) で解く
+// 子は num_threads 本のスレッドで並列に作る
+// st には全ワーカーの統計の合計を返す (最良解の時刻は、それが親に入った世代交代の時刻)
+Answer genetic(const City *city, int n, int num_threads, uint64_t seed, Stats *st)
+{
+  const double start = now_sec();
+  GA ga = { .city = city, .n = n, .pop = ga_pop, .next_child = 0, .done = 0,
+            .best_dist = INF, .best_time = start };
+  const Instance shared = inst;
+  ga.pool = (Answer*)malloc(sizeof(Answer) * 2 * ga_pop);
+  ga.tmp = (Answer*)malloc(sizeof(Answer) * 2 * ga_pop);
+  for (int k = 0; k < 2 * ga_pop; k++) {
+    ga.pool[k] = (Answer){ .dist = INF, .route = (int*)malloc(sizeof(int) * n)};
+  }
+  pthread_barrier_init(&ga.barrier, NULL, num_threads);
+
+  GAWorker *workers = (GAWorker*)calloc(num_threads, sizeof(GAWorker));
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    workers[t] = (GAWorker){ .ga = &ga, .seed = seed, .inst = &shared };
+  }
+  for (int t = 1; t < num_threads; t++) {
+    const int err = pthread_create(&threads[t], NULL, ga_worker, &workers[t]);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  ga_worker(&workers[0]);
+  for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+  *st = (Stats){ 0 };
+  for (int t = 0; t < num_threads; t++) stats_merge(st, &workers[t].stats);
+  st->time_to_best = ga.best_time - start;
+  st->time_total = now_sec() - start;
+
+  // 世代交代のあとは pool[0] が最良
+  Answer ans = (Answer){ .dist = ga.pool[0].dist, .route = (int*)malloc(sizeof(int) * n)};
+  memcpy(ans.route, ga.pool[0].route, sizeof(int) * n);
+  for (int t = 0; t < num_threads; t++) workspace_free(workers[t].ws);
+  for (int k = 0; k < 2 * ga_pop; k++) free(ga.pool[k].route);
+  pthread_barrier_destroy(&ga.barrier);
+  free(ga.pool);
+  free(ga.tmp);
+  free(workers);
+  free(threads);
+  return ans;
+}
+
+// Held-Karp の下界 (1-tree と劣勾配法)
+// 町0を除いた町の最小全域木に、町0から短い2辺を足したもの (1-tree) はどの巡回路よりも短い
+// 町ごとの罰金 pi を足した距離 d(i,j) + pi[i] + pi[j] で 1-tree を作ると、
+// 巡回路の長さは pi によらないので (1-tree の長さ) - 2 * sum(pi) も下界になる
+// 次数が2より大きい町の pi を上げ、1の町を下げるのを繰り返して下界を押し上げる
+// 最小全域木は密な Prim 法で作るので1反復 O(n^2)
+// best_pi が NULL でなければ、いちばん高い下界を与えた pi を書く (--exact の限定に使う)
+double held_karp_bound(int n, double *best_pi)
+{
+  if (n < 3) return 2 * dist(0, 1);
+  double *pi = (double*)calloc(n, sizeof(double));
+  double *key = (double*)malloc(sizeof(double) * n);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  int *deg = (int*)malloc(sizeof(int) * n);
+  char *visited = (char*)malloc(n);
+  int *rest = (int*)malloc(sizeof(int) * n); // まだ木に入っていない町
+
+  // 歩幅を決める上界: 町0からの最近傍法の巡回路
+  double ub = 0;
+  memset(visited, 0, n);
+  visited[0] = 1;
+  for (int k = 1, c = 0; k <= n; k++) {
+    int nx = 0;
+    double best = INF;
+    for (int u = 0; u < n; u++) {
+      if (!visited[u] && dist(c, u) < best) {
+        best = dist(c, u);
+        nx = u;
+      }
+    }
+    ub += dist(c, nx);
+    visited[nx] = 1;
+    c = nx;
+  }
+
+  double bound = -INF;
+  double lambda = 2;
+  int no_improve = 0;
+  for (int iter = 0; iter < 300 && lambda > 1e-3; iter++) {
+    // 町1..n-1 の最小全域木
+    // 木に入っていない町を rest[0..m) に詰めておき、key の更新と次の町の選択を1回の走査で行う
+    int m = 0;
+    for (int u = 1; u < n; u++) {
+      key[u] = INF;
+      deg[u] = 0;
+      rest[m++] = u;
+    }
+    double w = 0;
+    int v = 1;
+    parent[v] = -1;
+    key[v] = 0;
+    while (1) {
+      w += key[v];
+      if (parent[v] >= 0) {
+        deg[v]++;
+        deg[parent[v]]++;
+      }
+      int next = -1;
+      double next_key = INF;
+      for (int k = 0; k < m; k++) {
+        const int u = rest[k];
+        if (u == v) {
+          rest[k--] = rest[--m];
+          continue;
+        }
+        const double c = dist(v, u) + pi[v] + pi[u];
+        if (c < key[u]) {
+          key[u] = c;
+          parent[u] = v;
+        }
+        if (key[u] < next_key) {
+          next_key = key[u];
+          next = u;
+        }
+      }
+      if (next < 0) break;
+      v = next;
+    }
+    // 町0から短い2辺
+    int m1 = -1, m2 = -1;
+    double c1 = INF, c2 = INF;
+    for (int u = 1; u < n; u++) {
+      const double c = dist(0, u) + pi[0] + pi[u];
+      if (c < c1) {
+        c2 = c1;
+        m2 = m1;
+        c1 = c;
+        m1 = u;
+      }
+      else if (c < c2) {
+        c2 = c;
+        m2 = u;
+      }
+    }
+    w += c1 + c2;
+    deg[0] = 2;
+    deg[m1]++;
+    deg[m2]++;
+
+    double sum_pi = 0;
+    int norm = 0;
+    for (int u = 0; u < n; u++) {
+      sum_pi += pi[u];
+      norm += (deg[u] - 2) * (deg[u] - 2);
+    }
+    const double lb = w - 2 * sum_pi;
+    if (lb > bound + 1e-9) {
+      bound = lb;
+      no_improve = 0;
+      if (best_pi != NULL) memcpy(best_pi, pi, sizeof(double) * n);
+    }
+    else if (++no_improve == 20) { // しばらく上がらなければ歩幅を半分にする
+      lambda /= 2;
+      no_improve = 0;
+    }
+    if (norm == 0) break; // 1-tree が巡回路になった (最適解)
+    const double step = lambda * (ub - lb) / norm;
+    if (step <= 0) break;
+    for (int u = 0; u < n; u++) pi[u] += step * (deg[u] - 2);
+  }
+
+  free(pi);
+  free(key);
+  free(parent);
+  free(deg);
+  free(visited);
+  free(rest);
+  return bound;
+}
+
+// --window K: 探索で得た巡回路を、連続する K 個の位置 (窓) ごとに厳密に並べ直す
+// 窓の両隣の町は動かさず、窓の町を両隣の間を結ぶ最短の道順に並べ替える (端を固定した道の問題)
+// 両隣をまとめて町0、窓の町を町1..K とすると、d(0,u) = 左隣から u, d(u,0) = u から右隣 の
+// 非対称な K+1 都市の巡回路の問題になるので、advance_tsp_bitDP と同じ Held-Karp の表 (heldkarp.h) で解く
+//
+// 窓の中しか書き換えないので、1つ以上間を空けて並べた窓は同時に解ける
+// 1回ごとに窓を K+1 個おきに並べ、次の回は半分ずらして、窓の境目をまたぐ並べ替えも試す
+// 前に解いてから窓と両隣の町が変わっていない窓は解き直さず、2回続けてどの窓も改善しなければ終わる
+// 窓どうしは重ならず、1つの窓の答えは決まっているので、スレッド数によらず同じ巡回路になる
+// 窓の表 (2^K * K 要素) はワーカーごとに1度だけ確保して使い回す
+typedef struct
+{
+  const City *city;
+  int *route;          // 書き換える巡回路 (全ワーカーで共有する。自分の窓の中だけを書く)
+  int *stamp;          // stamp[i]: 位置 i を最後に書き換えた回
+  int n;
+  int k;               // 窓の大きさ
+  int phase;           // 何回目か
+  const int *starts;   // この回に解く窓の最初の位置
+  int num_starts;
+  int *next;           // 全ワーカーで共有する、次に解く窓の番号
+  HeldKarp hk;         // 窓の表 (k+1 都市)
+  double *d;           // (k+1) * (k+1) の距離
+  int *order;          // 窓の巡回順 (k+1 要素, order[0] = 0)
+  int *cities;         // 窓の町 (k 要素)
+  int *moved;          // 並べ替えた窓の町 (k 要素)
+  Stats stats;
+  const Instance *inst;
+} WindowWorker;
+
+// a, mid[0..k), b の順に通る道の長さ (座標から計算する。距離行列ファイルなら表から)
+double path_length(const City *city, int a, const int *mid, int k, int b)
+{
+  double len = exact_dist(city, a, mid[0]) + exact_dist(city, mid[k-1], b);
+  for (int i = 0; i + 1 < k; i++) len += exact_dist(city, mid[i], mid[i+1]);
+  return len;
+}
+
+void *window_worker(void *arg)
+{
+  WindowWorker *w = (WindowWorker*)arg;
+  inst = *w->inst;
+  const int n = w->n, k = w->k, k1 = w->k + 1;
+  int j;
+  while ((j = __atomic_fetch_add(w->next, 1, __ATOMIC_RELAXED)) < w->num_starts) {
+    const int s = w->starts[j];
+    const int a = w->route[(s + n - 1) % n];
+    const int b = w->route[(s + k) % n];
+    for (int i = 0; i < k; i++) w->cities[i] = w->route[(s + i) % n];
+    // 町0 = 両隣, 町 i+1 = 窓の i 番目の町
+    w->d[0] = 0;
+    for (int i = 0; i < k; i++) {
+      const int c = w->cities[i];
+      w->d[i+1] = dist(a, c);
+      w->d[(i+1) * k1] = dist(c, b);
+      for (int t = 0; t < k; t++) w->d[(i+1) * k1 + t + 1] = dist(c, w->cities[t]);
+    }
+    hk_set_dist(&w->hk, w->d);
+    hk_solve(&w->hk, 1, NULL);
+    hk_route(&w->hk, w->order);
+    for (int i = 0; i < k; i++) w->moved[i] = w->cities[w->order[i+1] - 1];
+    w->stats.windows_solved++;
+
+    // 座標から計算した長さで比べる (単精度の距離表の丸めで、同じ長さの並べ替えを繰り返さないように)
+    if (path_length(w->city, a, w->moved, k, b) < path_length(w->city, a, w->cities, k, b) - 1e-9) {
+      for (int i = 0; i < k; i++) {
+        w->route[(s + i) % n] = w->moved[i];
+        w->stamp[(s + i) % n] = w->phase;
+      }
+      w->stats.windows_improved++;
+    }
+  }
+  return NULL;
+}
+
+// route (町0が先頭) を窓ごとに並べ直す。解き終わったら町0が先頭になるように戻す
+// 窓と st の窓の数は num_threads 本のスレッドで分担して数える
+void window_optimize(const City *city, int n, int *route, int num_threads, Stats *st)
+{
+  const int k = min(window_size, n - 1); // 町が少なければ巡回路全体を1つの窓で解く
+  if (k < 2) return;
+  const int num_windows = n / (k + 1);
+  if (num_threads > num_windows) num_threads = num_windows;
+
+  const Instance shared = inst; // ワーカーはこれを自分の inst に写す
+  WindowWorker *workers = (WindowWorker*)calloc(num_threads, sizeof(WindowWorker));
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  int *stamp = (int*)calloc(n, sizeof(int));
+  int *solved_at = (int*)malloc(sizeof(int) * 2 * num_windows); // 偶数回と奇数回の窓ごとに、最後に解いた回
+  int *starts = (int*)malloc(sizeof(int) * num_windows);
+  int ok = 1;
+  for (int t = 0; t < num_threads; t++) {
+    WindowWorker *w = &workers[t];
+    *w = (WindowWorker){ .city = city, .route = route, .stamp = stamp, .n = n, .k = k, .starts = starts,
+                         .inst = &shared };
+    if (hk_alloc(&w->hk, k + 1, HK_F64, 1) != 0) ok = 0;
+    w->d = (double*)malloc(sizeof(double) * (k + 1) * (k + 1));
+    w->order = (int*)malloc(sizeof(int) * (k + 1));
+    w->cities = (int*)malloc(sizeof(int) * k);
+    w->moved = (int*)malloc(sizeof(int) * k);
+  }
+  if (!ok) fprintf(stderr, "--window is ignored: cannot allocate the table for %d cities\n", k);
+  for (int i = 0; i < 2 * num_windows; i++) solved_at[i] = -1;
+
+  long improved = 0;
+  for (int phase = 1, idle = 0; ok && idle < 2; phase++) {
+    const int parity = phase & 1;
+    const int offset = parity ? 0 : (k + 1) / 2;
+    int num_starts = 0;
+    for (int j = 0; j < num_windows; j++) {
+      const int s = offset + j * (k + 1);
+      int *last = &solved_at[parity * num_windows + j];
+      int dirty = (*last < 0);
+      for (int i = -1; i <= k && !dirty; i++) dirty = (stamp[(s + i + n) % n] > *last);
+      if (dirty) {
+        starts[num_starts++] = s % n;
+        *last = phase;
+      }
+    }
+    if (num_starts == 0) {
+      idle++;
+      continue;
+    }
+
+    int next = 0;
+    const int used = min(num_threads, num_starts);
+    for (int t = 0; t < used; t++) {
+      workers[t].phase = phase;
+      workers[t].num_starts = num_starts;
+      workers[t].next = &next;
+    }
+    // ワーカー0は呼び出し元のスレッドで動かす
+    for (int t = 1; t < used; t++) {
+      const int err = pthread_create(&threads[t], NULL, window_worker, &workers[t]);
+      if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(1);
+      }
+    }
+    window_worker(&workers[0]);
+    for (int t = 1; t < used; t++) pthread_join(threads[t], NULL);
+
+    long now = 0;
+    for (int t = 0; t < num_threads; t++) now += workers[t].stats.windows_improved;
+    idle = (now > improved) ? 0 : idle + 1;
+    improved = now;
+  }
+  rotate_route(route, n, stamp); // stamp はもう使わないので作業領域にする
+
+  for (int t = 0; t < num_threads; t++) {
+    stats_merge(st, &workers[t].stats);
+    hk_free(&workers[t].hk);
+    free(workers[t].d);
+    free(workers[t].order);
+    free(workers[t].cities);
+    free(workers[t].moved);
+  }
+  free(workers);
+  free(threads);
+  free(stamp);
+  free(solved_at);
+  free(starts);
+}
+
+// --exact SEC: 探索で得た巡回路を上界にして、分枝限定法で最適解を求める (または最適であることを示す)
+// 町0から始めて道を1町ずつ延ばす深さ優先の探索。子 (次の町) は今の町から近い順に試す
+// 限定には、残りの町を通って町0に戻る道の下界を使う:
+//   残りの町の最小全域木 + 今の町から残りへの最短の辺 + 残りから町0への最短の辺
+// (今の町と町0が端になる全域木なので、どの道よりも短い)。距離には held_karp_bound の罰金 pi を足し、
+// 道の上の町の次数 (端は1, それ以外は2) の分の pi を引く。pi は根で1度だけ求めたものを使い回す
+// 巡回路とその逆回りを両方調べないように、町0の前の町は町0の次の町 a より大きい番号に限る (町0への辺も a より大きい町だけ)
+//
+// メモリは O(n^2): 深さごとに子の候補 (n 個) を持つスタックをワーカーごとに1つ
+// ワーカーは自分のスタックの深い方から節を取り、仕事がなくなったら他のワーカーのスタックの
+// いちばん浅い未調査の子を盗む (浅い節ほど下に大きな部分木がある)
+typedef struct
+{
+  int n;
+  const double *cp;    // cp[i*n + j] = d(i,j) + pi[i] + pi[j]
+  const double *pi;
+  const int *nn;       // nn[v*(n-1) + k]: 町 v から k 番目に近い町
+  uint64_t full;       // 町1..n-1
+  double best;         // これまでの最短の巡回路の長さ (lock の中で書き、__atomic_load で読む)
+  int *best_route;
+  int active;          // 調べる節を持っているワーカーの数 (0 になったら終わり)
+  int stop;            // 時間切れ
+  double deadline;     // 0 なら時間制限なし
+  double slack;        // 下界が best - slack 以上なら切る (距離が整数なら長さも整数なので 1 近くまで切れる)
+  int num_threads;
+  pthread_mutex_t lock;
+} BBShared;
+
+typedef struct bb_worker
+{
+  BBShared *sh;
+  struct bb_worker *all; // 盗む相手 (全ワーカー)
+  int id;
+  int depth;          // スタックのいちばん深い節 (-1 なら節を持っていない)
+  int *path;          // path[0..depth] (path[0] = 0)
+  double *cost;       // cost[d]: path[0..d] の長さ
+  uint64_t *mask;     // mask[d]: path[0..d] の町
+  int *cand;          // cand[d*n + i]: 深さ d の節の子の候補 (近い順)
+  int *next;          // cand[d*n + next[d] .. d*n + cnt[d]) がまだ調べていない子
+  int *cnt;
+  double *key;        // 下界の最小全域木の作業領域
+  int *member;
+  long nodes;
+  pthread_mutex_t lock; // depth, next, cnt を盗むワーカーから守る (path などは depth より浅い所だけ読まれる)
+  const Instance *inst;
+} BBWorker;
+
+static double bb_best(BBShared *sh)
+{
+  double best;
+  __atomic_load(&sh->best, &best, __ATOMIC_RELAXED);
+  return best;
+}
+
+// 町 v から残りの町 rest を全部通って町0に戻る道の下界 (町0の手前の町は a より大きい番号に限る)
+double bb_bound(const BBShared *sh, int v, uint64_t rest, int a, double *key, int *member)
+{
+  const int n = sh->n;
+  const double *cp = sh->cp, *pi = sh->pi;
+  int m = 0;
+  double sum_pi = 0, to_v = INF, to_0 = INF;
+  for (uint64_t r = rest; r != 0; r &= r - 1) {
+    const int u = __builtin_ctzll(r);
+    member[m++] = u;
+    sum_pi += pi[u];
+    if (cp[v*n + u] < to_v) to_v = cp[v*n + u];
+    if (u > a && cp[u] < to_0) to_0 = cp[u];
+  }
+  if (to_0 == INF) return INF; // a より大きい町が残っていない
+
+  // 残りの町の最小全域木 (密な Prim 法)。木に入った町は member の末尾と入れ替えて外す
+  double w = 0;
+  int v0 = member[--m];
+  for (int k = 0; k < m; k++) key[k] = cp[v0*n + member[k]];
+  while (m > 0) {
+    int j = 0;
+    for (int k = 1; k < m; k++) {
+      if (key[k] < key[j]) j = k;
+    }
+    w += key[j];
+    v0 = member[j];
+    member[j] = member[--m];
+    key[j] = key[m];
+    for (int k = 0; k < m; k++) {
+      const double c = cp[v0*n + member[k]];
+      if (c < key[k]) key[k] = c;
+    }
+  }
+  return w + to_v + to_0 - 2 * sum_pi - pi[v] - pi[0];
+}
+
+// 他のワーカーのいちばん浅い未調査の子を1つ盗んで、自分のスタックに積む。なければ 0
+int bb_steal(BBWorker *w)
+{
+  const BBShared *sh = w->sh;
+  const int n = sh->n;
+  for (int j = 1; j < sh->num_threads; j++) {
+    BBWorker *v = &w->all[(w->id + j) % sh->num_threads];
+    pthread_mutex_lock(&v->lock);
+    for (int d = 0; d <= v->depth; d++) {
+      if (v->next[d] == v->cnt[d]) continue;
+      const int c = v->cand[d*n + --v->cnt[d]];
+      memcpy(w->path, v->path, sizeof(int) * (d + 1));
+      w->cost[d] = v->cost[d];
+      w->mask[d] = v->mask[d];
+      __atomic_fetch_add(&w->sh->active, 1, __ATOMIC_RELAXED); // v が節を持っている間に数える
+      pthread_mutex_unlock(&v->lock);
+
+      pthread_mutex_lock(&w->lock);
+      for (int e = 0; e < d; e++) w->next[e] = w->cnt[e] = 0;
+      w->cand[d*n] = c;
+      w->next[d] = 0;
+      w->cnt[d] = 1;
+      w->depth = d;
+      pthread_mutex_unlock(&w->lock);
+      return 1;
+    }
+    pthread_mutex_unlock(&v->lock);
+  }
+  return 0;
+}
+
+void *bb_worker(void *arg)
+{
+  BBWorker *w = (BBWorker*)arg;
+  BBShared *sh = w->sh;
+  if (w->id > 0) inst = *w->inst;
+  const int n = sh->n;
+  const struct timespec idle = { 0, 50000 };
+  while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+    if (w->depth < 0 && !bb_steal(w)) {
+      if (__atomic_load_n(&sh->active, __ATOMIC_ACQUIRE) == 0) break;
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    pthread_mutex_lock(&w->lock);
+    const int d = w->depth;
+    if (w->next[d] == w->cnt[d]) {
+      if (--w->depth < 0) __atomic_fetch_sub(&sh->active, 1, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&w->lock);
+      continue;
+    }
+    const int c = w->cand[d*n + w->next[d]++];
+    pthread_mutex_unlock(&w->lock);
+
+    if ((++w->nodes & 4095) == 0 && sh->deadline > 0 && now_sec() > sh->deadline) {
+      __atomic_store_n(&sh->stop, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    const int v = w->path[d];
+    const double len = w->cost[d] + dist(v, c);
+    const uint64_t rest = sh->full & ~(w->mask[d] | (uint64_t)1 << c);
+    const double best = bb_best(sh);
+    if (rest == 0) { // 巡回路ができた
+      const double total = len + dist(c, 0);
+      if (total < best - 1e-9) {
+        pthread_mutex_lock(&sh->lock);
+        if (total < sh->best - 1e-9) {
+          memcpy(sh->best_route, w->path, sizeof(int) * (d + 1));
+          sh->best_route[d+1] = c;
+          __atomic_store(&sh->best, &total, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&sh->lock);
+      }
+      continue;
+    }
+    const int a = (d == 0) ? c : w->path[1];
+    if (len + bb_bound(sh, c, rest, a, w->key, w->member) >= best - sh->slack) continue;
+
+    // 子を積む (depth を増やすまでは盗むワーカーが読まない)
+    const int e = d + 1;
+    w->path[e] = c;
+    w->cost[e] = len;
+    w->mask[e] = w->mask[d] | (uint64_t)1 << c;
+    int k = 0;
+    for (int i = 0; i < n - 1; i++) {
+      const int u = sh->nn[c*(n-1) + i];
+      if (rest >> u & 1) w->cand[e*n + k++] = u;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->next[e] = 0;
+    w->cnt[e] = k;
+    w->depth = e;
+    pthread_mutex_unlock(&w->lock);
+  }
+  return NULL;
+}
+
+// route (町0が先頭) より短い巡回路を探し、見つかれば route を書き換える
+// pi は held_karp_bound の罰金。探索を最後まで終えた (route が最適だと示せた) ら 1、時間切れなら 0 を返す
+int exact_search(int n, int *route, const double *pi, int num_threads, Stats *st)
+{
+  double *cp = (double*)malloc(sizeof(double) * n * n);
+  int *nn = (int*)malloc(sizeof(int) * n * (n - 1));
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) cp[i*n + j] = dist(i, j) + pi[i] + pi[j];
+    // 近い順に挿入ソート (n <= 64)
+    int *row = &nn[i*(n-1)];
+    int k = 0;
+    for (int j = 0; j < n; j++) {
+      if (j == i) continue;
+      int p = k++;
+      while (p > 0 && dist(i, row[p-1]) > dist(i, j)) {
+        row[p] = row[p-1];
+        p--;
+      }
+      row[p] = j;
+    }
+  }
+  BBShared sh = { .n = n, .cp = cp, .pi = pi, .nn = nn, .active = 1, .num_threads = num_threads,
+                  .full = ((n == 64) ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1) & ~(uint64_t)1,
+                  .deadline = (exact_limit > 0) ? now_sec() + exact_limit : 0,
+                  .slack = inst.integral ? 1 - 1e-6 : 1e-9 };
+  sh.best_route = (int*)malloc(sizeof(int) * n);
+  memcpy(sh.best_route, route, sizeof(int) * n);
+  sh.best = 0;
+  for (int i = 0; i < n; i++) sh.best += dist(route[i], route[(i + 1) % n]);
+  const double initial = sh.best;
+  pthread_mutex_init(&sh.lock, NULL);
+
+  BBWorker *workers = (BBWorker*)calloc(num_threads, sizeof(BBWorker));
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    BBWorker *w = &workers[t];
+    *w = (BBWorker){ .sh = &sh, .all = workers, .id = t, .depth = -1, .inst = &inst };
+    w->path = (int*)malloc(sizeof(int) * n);
+    w->cost = (double*)malloc(sizeof(double) * n);
+    w->mask = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    w->cand = (int*)malloc(sizeof(int) * n * n);
+    w->next = (int*)calloc(n, sizeof(int));
+    w->cnt = (int*)calloc(n, sizeof(int));
+    w->key = (double*)malloc(sizeof(double) * n);
+    w->member = (int*)malloc(sizeof(int) * n);
+    pthread_mutex_init(&w->lock, NULL);
+  }
+  // 根 (町0だけの道) はワーカー0が持つ
+  BBWorker *root = &workers[0];
+  root->depth = 0;
+  root->path[0] = 0;
+  root->cost[0] = 0;
+  root->mask[0] = 1;
+  memcpy(root->cand, nn, sizeof(int) * (n - 1));
+  root->cnt[0] = n - 1;
+
+  for (int t = 1; t < num_threads; t++) {
+    const int err = pthread_create(&threads[t], NULL, bb_worker, &workers[t]);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  bb_worker(&workers[0]);
+  for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+
+  if (sh.best < initial) memcpy(route, sh.best_route, sizeof(int) * n);
+  for (int t = 0; t < num_threads; t++) {
+    BBWorker *w = &workers[t];
+    st->exact_nodes += w->nodes;
+    free(w->path);
+    free(w->cost);
+    free(w->mask);
+    free(w->cand);
+    free(w->next);
+    free(w->cnt);
+    free(w->key);
+    free(w->member);
+    pthread_mutex_destroy(&w->lock);
+  }
+  st->exact_proved = !sh.stop;
+  pthread_mutex_destroy(&sh.lock);
+  free(workers);
+  free(threads);
+  free(sh.best_route);
+  free(cp);
+  free(nn);
+  return !sh.stop;
+}
+
+// 1つのインスタンスを解く
+// 距離表, 近傍リスト, 貪欲法の初期解はこのスレッドの inst に作り、解き終わったら解放する
+// 表示する距離は座標から計算し直す (単精度の距離表を使った場合も正確な値にする)
+// matrix が NULL でなければ、座標の代わりに距離行列ファイルの表をそのまま使う (解放はしない)
+// 非対称な行列では入れ替え近傍だけで探し、下界と --exact は求めない (--window は向きを考えて解く)
+// lower_bound には Held-Karp の下界を返す (求めなければ 0)。st には探索の統計を返す
+// --window なら、探索で得た巡回路を最後に窓ごとに厳密に並べ直す
+// --exact なら、さらに分枝限定法で最適解を求め、示せたら lower_bound を巡回路の長さにする
+Answer solve_instance(const City *city, const DistMatrix *matrix, int n, long num_restarts, int num_threads,
+                      uint64_t seed, double gap_pct, double *lower_bound, Stats *st)
+{
+  int stop_search = 0;
+  inst = (Instance){ .dm = (matrix != NULL) ? *matrix : dm_build(city, n, dist_kind, metric, dist_mem_limit),
+                     .stop_search = &stop_search,
+                     .asymmetric = (matrix != NULL && !dm_symmetric(matrix)),
+                     .integral = (matrix != NULL) ? (matrix->kind == DM_FULL_I32) : (metric == DM_EUC2D) };
+  if (inst.asymmetric && search_method != SEARCH_SWAP) {
+    fprintf(stderr, "the distance matrix is asymmetric: using the swap neighborhood instead of 2opt/lk\n");
+  }
+  if ((search_method == SEARCH_2OPT || search_method == SEARCH_LK) && !inst.asymmetric) {
+    inst.num_neighbor = min(num_neighbor, n-1);
+    inst.neighbor = build_neighbor_lists(city, n, inst.num_neighbor);
+  }
+  if (init_method == INIT_GREEDY) {
+    inst.greedy_route = greedy_edge_tour(city, n);
+  }
+  // 下界は探索の前に求め、--gap の目標にも使う
+  *lower_bound = 0;
+  double *pi = NULL; // --exact の限定に使う罰金
+  if (exact_limit >= 0 && inst.asymmetric) {
+    fprintf(stderr, "--exact is ignored: the distance matrix is asymmetric\n");
+  }
+  else if (exact_limit >= 0 && n > exact_max_n) {
+    fprintf(stderr, "--exact is ignored: branch and bound is only used up to %d cities\n", exact_max_n);
+  }
+  else if (exact_limit >= 0 && n >= 4) {
+    pi = (double*)malloc(sizeof(double) * n);
+  }
+  if (inst.asymmetric) {
+    if (gap_pct >= 0) fprintf(stderr, "--gap is ignored: the lower bound needs symmetric distances\n");
+  }
+  else if (n <= bound_max_n) {
+    *lower_bound = held_karp_bound(n, pi);
+    if (inst.integral) *lower_bound = ceil(*lower_bound - 1e-6); // 巡回路の長さは整数なので切り上げてよい
+    if (gap_pct >= 0) inst.gap_target = *lower_bound * (1 + gap_pct / 100) + 1e-9;
+  }
+  else if (gap_pct >= 0) {
+    fprintf(stderr, "--gap is ignored: the lower bound is only computed up to %d cities\n", bound_max_n);
+  }
+
+  Answer ans = (ga_pop > 0) ? genetic(city, n, num_threads, seed, st)
+                            : multi_start(city, n, num_restarts, num_threads, seed, st);
+  if (ans.dist != INF && window_size > 0) window_optimize(city, n, ans.route, num_threads, st);
+  int proved = 0;
+  if (ans.dist != INF && pi != NULL) {
+    proved = exact_search(n, ans.route, pi, num_threads, st);
+    if (!proved) fprintf(stderr, "--exact: time limit reached, the tour is not proven optimal\n");
+  }
+  if (ans.dist != INF) {
+    ans.dist = route_length(city, ans.route, n);
+    if (*lower_bound > ans.dist || proved) *lower_bound = ans.dist; // 最適解が見つかったときの丸め誤差
+  }
+  free(pi);
+
+  free(inst.neighbor);
+  free(inst.greedy_route);
+  if (matrix == NULL) dm_free(&inst.dm);
+  inst = (Instance){ .dm = { .kind = DM_IMPLICIT } };
+  return ans;
+}
+
+// --batch: 複数のインスタンスを num_threads 本のスレッドで1つずつ取って解く
+// 1つのインスタンスは1スレッドで解き、解き終わった順に1行ずつ表示する
+typedef struct
+{
+  char **files;
+  int num_files;
+  int next;            // 次に解くファイルの番号
+  long num_restarts;
+  uint64_t seed;
+  double gap_pct;
+  FILE *stats_fp;       // --stats の出力先 (NULL なら書かない)
+  int num_failed;
+  pthread_mutex_t lock; // 出力と num_failed を守る
+} Batch;
+
+void *batch_worker(void *arg)
+{
+  Batch *b = (Batch*)arg;
+  int k;
+  while ((k = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->num_files) {
+    const double start = now_sec();
+    int n;
+    City *city;
+    DistMatrix matrix;
+    const int loaded = (load_instance(b->files[k], &city, &matrix, &n) == 0);
+    Answer ans = { .dist = INF, .route = NULL };
+    double lower_bound = 0;
+    Stats st = { 0 };
+    if (loaded) {
+      ans = solve_instance(city, (city == NULL) ? &matrix : NULL, n, b->num_restarts, 1, b->seed, b->gap_pct,
+                           &lower_bound, &st);
+    }
+    const double elapsed = now_sec() - start;
+
+    pthread_mutex_lock(&b->lock);
+    if (ans.dist == INF) {
+      printf("%s: failed\n", b->files[k]);
+      b->num_failed++;
+    }
+    else if (lower_bound > 0) {
+      printf("%s: total distance = %f (n = %d, gap %.3f%%, %.3f s)\n", b->files[k], ans.dist, n,
+             (ans.dist - lower_bound) / lower_bound * 100, elapsed);
+    }
     else {
-      origin_distance = ans.dist;
-      free(ans.route);
+      printf("%s: total distance = %f (n = %d, %.3f s)\n", b->files[k], ans.dist, n, elapsed);
     }
+    fflush(stdout);
+    if (b->stats_fp != NULL && loaded) write_stats(b->stats_fp, b->files[k], n, 1, ans.dist, lower_bound, &st);
+    pthread_mutex_unlock(&b->lock);
+    free(ans.route);
+    free(city);
+    dm_free(&matrix);
   }
+  return NULL;
+}
 
-  return ans; 
+int run_batch(const char *path, long num_restarts, int num_threads, uint64_t seed, double gap_pct,
+              FILE *stats_fp)
+{
+  Batch b = { .num_restarts = num_restarts, .seed = seed, .gap_pct = gap_pct, .stats_fp = stats_fp };
+  b.files = batch_list(path, &b.num_files);
+  if (b.files == NULL) {
+    fprintf(stderr, "%s: cannot open.\n", path);
+    return EXIT_FAILURE;
+  }
+  pthread_mutex_init(&b.lock, NULL);
+  if (num_threads > b.num_files) num_threads = (b.num_files > 0) ? b.num_files : 1;
+  pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (int t = 1; t < num_threads; t++) {
+    const int err = pthread_create(&threads[t], NULL, batch_worker, &b);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  batch_worker(&b);
+  for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+  pthread_mutex_destroy(&b.lock);
+  free(threads);
+  batch_free(b.files, b.num_files);
+  return (b.num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /*Answer solve(const City *city, int n, int *route, int *visited, int visited_number)
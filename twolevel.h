@@ -0,0 +1,343 @@
+#ifndef TWOLEVEL_H
+#define TWOLEVEL_H
+
+// 巡回路の 2-level doubly-linked list 表現
+// 町を約 sqrt(n) 個ずつの区間 (segment) に分け、区間ごとに反転フラグを持つ
+//
+// tl_next / tl_prev / tl_between: O(1)
+// tl_reverse:                     O(sqrt n) (区間の境目で切り、区間の並びを反転する)
+//                                 1つの区間に収まる道はその場で反転する
+//
+// 区間の中の町は rank の昇順に nsuc / npred でつながっている (この向きを「内部の向き」と呼ぶ)
+// rev[s] が立っている区間は、巡回路の向きでは内部の向きと逆にたどる
+// 区間どうしは ssuc / spred で巡回路の向きにつながっている
+// 区間の数は変えない。区間の途中で切るときは小さい方を隣の区間に移す
+// 区間が大きくなりすぎたら巡回路から作り直す
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef struct
+{
+  int n;
+  // 町ごと
+  int *nsuc, *npred; // 区間内の内部の向きの隣 (端では -1)
+  int *rank;         // 区間内の内部の向きの順位
+  int *parent;       // 属する区間
+  // 区間ごと
+  int *first, *last; // 内部の向きの先頭と末尾
+  int *size;
+  int *ssuc, *spred; // 巡回路の向きの次と前の区間
+  int *srank;        // 区間の並び順 (巡回路の向きに増える。0 の区間から数える)
+  char *rev;
+  int num_seg;
+  int group;         // 作り直したときの区間の大きさ
+  int max_size;      // 区間がこれより大きくなったら作り直す
+  int need_rebuild;
+  int *order;        // 作り直し用の作業領域
+} TwoLevel;
+
+static void tl_alloc(TwoLevel *tl, int n)
+{
+  tl->n = n;
+  tl->group = (int)sqrt((double)n);
+  if (tl->group < 8) tl->group = 8;
+  tl->max_size = 4 * tl->group;
+  const int m = (n + tl->group - 1) / tl->group;
+  tl->nsuc = (int*)malloc(sizeof(int) * n);
+  tl->npred = (int*)malloc(sizeof(int) * n);
+  tl->rank = (int*)malloc(sizeof(int) * n);
+  tl->parent = (int*)malloc(sizeof(int) * n);
+  tl->order = (int*)malloc(sizeof(int) * n);
+  tl->first = (int*)malloc(sizeof(int) * m);
+  tl->last = (int*)malloc(sizeof(int) * m);
+  tl->size = (int*)malloc(sizeof(int) * m);
+  tl->ssuc = (int*)malloc(sizeof(int) * m);
+  tl->spred = (int*)malloc(sizeof(int) * m);
+  tl->srank = (int*)malloc(sizeof(int) * m);
+  tl->rev = (char*)malloc(m);
+}
+
+static void tl_free(TwoLevel *tl)
+{
+  free(tl->nsuc);
+  free(tl->npred);
+  free(tl->rank);
+  free(tl->parent);
+  free(tl->order);
+  free(tl->first);
+  free(tl->last);
+  free(tl->size);
+  free(tl->ssuc);
+  free(tl->spred);
+  free(tl->srank);
+  free(tl->rev);
+}
+
+// 巡回順 route[0..n) から作る
+static void tl_load(TwoLevel *tl, const int *route)
+{
+  const int n = tl->n;
+  const int g = tl->group;
+  const int m = (n + g - 1) / g;
+  for (int s = 0; s < m; s++) {
+    const int lo = s * g;
+    const int hi = (lo + g < n) ? lo + g : n;
+    tl->first[s] = route[lo];
+    tl->last[s] = route[hi-1];
+    tl->size[s] = hi - lo;
+    tl->ssuc[s] = (s + 1 == m) ? 0 : s + 1;
+    tl->spred[s] = (s == 0) ? m - 1 : s - 1;
+    tl->srank[s] = s;
+    tl->rev[s] = 0;
+    for (int i = lo; i < hi; i++) {
+      const int c = route[i];
+      tl->parent[c] = s;
+      tl->rank[c] = i - lo;
+      tl->nsuc[c] = (i + 1 < hi) ? route[i+1] : -1;
+      tl->npred[c] = (i > lo) ? route[i-1] : -1;
+    }
+  }
+  tl->num_seg = m;
+  tl->need_rebuild = 0;
+}
+
+static inline int tl_next(const TwoLevel *tl, int c)
+{
+  const int s = tl->parent[c];
+  if (!tl->rev[s]) {
+    if (c != tl->last[s]) return tl->nsuc[c];
+  }
+  else {
+    if (c != tl->first[s]) return tl->npred[c];
+  }
+  const int s2 = tl->ssuc[s];
+  return tl->rev[s2] ? tl->last[s2] : tl->first[s2];
+}
+
+static inline int tl_prev(const TwoLevel *tl, int c)
+{
+  const int s = tl->parent[c];
+  if (!tl->rev[s]) {
+    if (c != tl->first[s]) return tl->npred[c];
+  }
+  else {
+    if (c != tl->last[s]) return tl->nsuc[c];
+  }
+  const int s2 = tl->spred[s];
+  return tl->rev[s2] ? tl->first[s2] : tl->last[s2];
+}
+
+// 巡回路の向きで a が b より前 (区間の並びは srank 0 の区間から数える) なら負
+static inline int tl_compare(const TwoLevel *tl, int a, int b)
+{
+  const int sa = tl->parent[a];
+  const int sb = tl->parent[b];
+  if (sa != sb) return tl->srank[sa] - tl->srank[sb];
+  return tl->rev[sa] ? tl->rank[b] - tl->rank[a] : tl->rank[a] - tl->rank[b];
+}
+
+// a から巡回路の向きにたどって c に着くまでに b を通るか
+static inline int tl_between(const TwoLevel *tl, int a, int b, int c)
+{
+  if (tl_compare(tl, a, c) <= 0) return tl_compare(tl, a, b) <= 0 && tl_compare(tl, b, c) <= 0;
+  return tl_compare(tl, a, b) <= 0 || tl_compare(tl, b, c) <= 0;
+}
+
+// 巡回路を町 0 からたどって作り直す
+static void tl_rebuild(TwoLevel *tl)
+{
+  int c = 0;
+  for (int i = 0; i < tl->n; i++) {
+    tl->order[i] = c;
+    c = tl_next(tl, c);
+  }
+  tl_load(tl, tl->order);
+}
+
+// 町 c を区間 d の巡回路の向きで末尾 / 先頭に付け加える
+static void tl_push_back(TwoLevel *tl, int d, int c)
+{
+  if (!tl->rev[d]) {
+    const int e = tl->last[d];
+    tl->npred[c] = e;
+    tl->nsuc[c] = -1;
+    tl->nsuc[e] = c;
+    tl->rank[c] = tl->rank[e] + 1;
+    tl->last[d] = c;
+  }
+  else {
+    const int e = tl->first[d];
+    tl->nsuc[c] = e;
+    tl->npred[c] = -1;
+    tl->npred[e] = c;
+    tl->rank[c] = tl->rank[e] - 1;
+    tl->first[d] = c;
+  }
+  tl->parent[c] = d;
+  if (++tl->size[d] > tl->max_size) tl->need_rebuild = 1;
+}
+
+static void tl_push_front(TwoLevel *tl, int d, int c)
+{
+  if (!tl->rev[d]) {
+    const int e = tl->first[d];
+    tl->nsuc[c] = e;
+    tl->npred[c] = -1;
+    tl->npred[e] = c;
+    tl->rank[c] = tl->rank[e] - 1;
+    tl->first[d] = c;
+  }
+  else {
+    const int e = tl->last[d];
+    tl->npred[c] = e;
+    tl->nsuc[c] = -1;
+    tl->nsuc[e] = c;
+    tl->rank[c] = tl->rank[e] + 1;
+    tl->last[d] = c;
+  }
+  tl->parent[c] = d;
+  if (++tl->size[d] > tl->max_size) tl->need_rebuild = 1;
+}
+
+// 巡回路の向きで x の直後を区間の境目にする
+// x までの前側と x より後ろの後側のうち小さい方を隣の区間に移すので O(区間の大きさ)
+static void tl_cut_after(TwoLevel *tl, int x)
+{
+  const int s = tl->parent[x];
+  const int rev = tl->rev[s];
+  if (x == (rev ? tl->first[s] : tl->last[s])) return; // すでに境目
+  // 内部の向きで u -> v の間を切る
+  const int u = rev ? tl->npred[x] : x;
+  const int v = rev ? x : tl->nsuc[x];
+  const int left = tl->rank[u] - tl->rank[tl->first[s]] + 1;
+  const int right = tl->size[s] - left;
+  const int front = rev ? right : left; // 巡回路の向きで前側の町の数
+  const int back = tl->size[s] - front;
+  tl->nsuc[u] = -1;
+  tl->npred[v] = -1;
+  if (front <= back) {
+    // 前側を巡回路の向きの順に前の区間の末尾へ
+    const int p = tl->spred[s];
+    int c = rev ? tl->last[s] : tl->first[s];
+    if (rev) tl->last[s] = u;
+    else tl->first[s] = v;
+    tl->size[s] -= front;
+    for (int i = 0; i < front; i++) {
+      const int nx = rev ? tl->npred[c] : tl->nsuc[c];
+      tl_push_back(tl, p, c);
+      c = nx;
+    }
+  }
+  else {
+    // 後側を巡回路の逆の順に次の区間の先頭へ
+    const int q = tl->ssuc[s];
+    int c = rev ? tl->first[s] : tl->last[s];
+    if (rev) tl->first[s] = v;
+    else tl->last[s] = u;
+    tl->size[s] -= back;
+    for (int i = 0; i < back; i++) {
+      const int nx = rev ? tl->nsuc[c] : tl->npred[c];
+      tl_push_front(tl, q, c);
+      c = nx;
+    }
+  }
+}
+
+// 区間 s1 から s2 まで (巡回路の向きに k 個) の並びを反転する
+// 各位置の srank はそのまま残すので、範囲の外の並び順は変わらない
+static void tl_reverse_segments(TwoLevel *tl, int s1, int s2, int k)
+{
+  const int p = tl->spred[s1];
+  const int q = tl->ssuc[s2];
+  int *rank = tl->order;
+  int s = s1;
+  for (int i = 0; i < k; i++) {
+    rank[i] = tl->srank[s];
+    const int nx = tl->ssuc[s];
+    tl->ssuc[s] = tl->spred[s];
+    tl->spred[s] = nx;
+    tl->rev[s] ^= 1;
+    s = nx;
+  }
+  tl->ssuc[p] = s2;
+  tl->spred[s2] = p;
+  tl->ssuc[s1] = q;
+  tl->spred[q] = s1;
+  s = s2;
+  for (int i = 0; i < k; i++) {
+    tl->srank[s] = rank[i];
+    s = tl->ssuc[s];
+  }
+}
+
+// 1つの区間の中にある道を、区間を切らずにその場で反転する
+// 内部の向きで x から y まで (rank[x] <= rank[y]) の町を逆順につなぎ直す
+static void tl_reverse_inside(TwoLevel *tl, int x, int y)
+{
+  const int s = tl->parent[x];
+  const int p = tl->npred[x];
+  const int q = tl->nsuc[y];
+  int r = tl->rank[x];
+  int c = y;
+  int prev = p;
+  while (1) {
+    const int nx = tl->npred[c]; // 内部の向きで1つ前 (書き換える前に読む)
+    tl->rank[c] = r++;
+    tl->npred[c] = prev;
+    if (prev >= 0) tl->nsuc[prev] = c;
+    prev = c;
+    if (c == x) break;
+    c = nx;
+  }
+  tl->nsuc[x] = q;
+  if (q >= 0) tl->npred[q] = x;
+  if (p < 0) tl->first[s] = y;
+  if (q < 0) tl->last[s] = x;
+}
+
+// 区間 parent[b] の中で巡回路の向きに b から c までの道を反転する
+static void tl_reverse_in_segment(TwoLevel *tl, int b, int c)
+{
+  if (tl->rev[tl->parent[b]]) tl_reverse_inside(tl, c, b);
+  else tl_reverse_inside(tl, b, c);
+}
+
+// 巡回路の向きで b から c までの道を反転する
+static void tl_reverse(TwoLevel *tl, int b, int c)
+{
+  if (b == c || tl_next(tl, c) == b) return; // 1町だけ / 全体の反転は同じ巡回路
+  // 区間の中に収まる道は切らずに反転する (補集合を反転しても同じ巡回路になる)
+  if (tl->parent[b] == tl->parent[c]) {
+    if (tl_compare(tl, b, c) < 0) tl_reverse_in_segment(tl, b, c);
+    else tl_reverse_in_segment(tl, tl_next(tl, c), tl_prev(tl, b));
+    return;
+  }
+  tl_cut_after(tl, tl_prev(tl, b));
+  tl_cut_after(tl, c);
+  const int sb = tl->parent[b];
+  const int sc = tl->parent[c];
+  // 2回目に切ったときに町が移ると、道か補集合が1つの区間に入ることがある
+  if (sb == sc) tl_reverse_in_segment(tl, b, c);
+  else if (tl->parent[tl_prev(tl, b)] == sb) tl_reverse_in_segment(tl, tl_next(tl, c), tl_prev(tl, b));
+  else {
+    int k = 1;
+    for (int s = sb; s != sc; s = tl->ssuc[s]) k++;
+    if (2 * k > tl->num_seg) tl_reverse_segments(tl, tl->ssuc[sc], tl->spred[sb], tl->num_seg - k);
+    else tl_reverse_segments(tl, sb, sc, k);
+  }
+  if (tl->need_rebuild) tl_rebuild(tl);
+}
+
+// 町 0 から巡回順に route へ書き出す
+static void tl_store(const TwoLevel *tl, int *route)
+{
+  int c = 0;
+  for (int i = 0; i < tl->n; i++) {
+    route[i] = c;
+    c = tl_next(tl, c);
+  }
+}
+
+#endif
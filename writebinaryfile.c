@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "rng.h"
 
 int main(int argc, char**argv)
 {
@@ -13,9 +14,10 @@ int main(int argc, char**argv)
   size_t size = 10000000;
   double *d = (double*)malloc(sizeof(double)*size); // とりあえず1000万確保
 
-  srand(100);
+  Rng rng;
+  rng_init(&rng, 100);
   for(int i = 0 ; i < size ; i++)
-    d[i] = 0.5423 * rand();
+    d[i] = 0.5423 * rng_below(&rng, (uint32_t)RAND_MAX + 1); // rand() と同じ [0, RAND_MAX]
 
   //テキストに出力してみる
   FILE *fp;